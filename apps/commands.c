@@ -5,12 +5,61 @@
 #include "hardware/clocks.h"
 #include "logic_analyser.h"
 #include "main.h"
+#include "perf.h"
+#include "log.h"
+#include "stream.h"
 #include "commands.h"
 
 static inline uint32_t tu_max32 (uint32_t x, uint32_t y) { return (x > y) ? x : y; }
-void dma_irq();
-uint dma_chan;
-uint generator_dma_channel;
+
+/*******************************************************************************************
+ * Per analyser state. Both analysers capture into capture_buf, analyser 0 from the bottom
+ * and analyser 1 from the top, so either can use the whole buffer when the other is idle.
+ * *****************************************************************************************/
+typedef struct ANALYSER_T_ {
+    LOGIC_ANALYSER_T la;
+    uint32_t *buffer;
+    uint32_t capture_words;
+    volatile int num_samples;
+    float sample_rate;
+    uint trig_channel;
+    uint trig_type;
+    volatile bool sampleRun;
+    volatile bool commandComplete;
+    volatile bool triggerSeen;
+    volatile bool acquirePending;
+    void *waiter;       // the transport's sender of the pending l:acq?, it gets the block
+    void *owner;        // the transport's sender that armed the capture
+} ANALYSER_T;
+
+static const uint8_t idn[] = "Rasp Pico Logic,1.0,1001,v1.0\r\n";
+static const uint8_t opc_1[] = "1\r\n";
+static const uint8_t opc_0[] = "0\r\n";
+static const uint8_t empty_block[] = "#10";
+static uint32_t capture_buf[MAX_BUFFER_SIZE];
+static uint32_t pattern_buf[PATTERN_MAX_WORDS];
+
+// response buffers, sized for their largest reply
+static uint8_t esr_buf[16];     // "4294967295\r\n"
+static uint8_t count_buf[16];   // "4294967295\r\n"
+static uint8_t block_header[12];// "#6nnnnnn"
+static uint8_t env_buf[2*ENV_MAX_BUCKETS];
+static uint8_t perf_buf[1024];
+static uint8_t stream_buf[40];  // "1,4294967295,4294967295\r\n"
+
+static ANALYSER_T analysers[ANALYSER_COUNT];
+static ANALYSER_T *current = &analysers[0];
+static volatile uint pattern=0;
+static uint32_t status_register;
+static uint generator_dma_channel;
+static void (*capture_notify)(void);
+static bool (*capture_held)(void);
+static volatile uint32_t captures_completed;
+static void *sender;        // who sent the command being processed, see set_command_sender()
+
+static void capture_complete(LOGIC_ANALYSER_T *la);
+static void stop_analyser(ANALYSER_T *analyser);
+static bool run_analyzer(ANALYSER_T *analyser, uint sample_count, float freq_div, uint trigger_pin, uint trigger_type);
 
 #define _CMD(_CMD_STR, _STR_LEN, _FUNC) \
     if(aLen >=_STR_LEN && !strncasecmp(_CMD_STR, (char*)aData,_STR_LEN)) \
@@ -18,20 +67,38 @@ uint generator_dma_channel;
 
 void initialise_commands()
 {
-    dma_chan = dma_claim_unused_channel (true);
+    uint analyser_dma = dma_claim_unused_channel (true);
     generator_dma_channel = dma_claim_unused_channel (true);
+    logic_analyser_create(&analysers[0].la, pio0, 0, analyser_dma, ANALYSER_PIN_BASE, 8, capture_complete, &analysers[0]);
+    logic_analyser_create(&analysers[1].la, pio1, 0, dma_claim_unused_channel (true), ANALYSER2_PIN_BASE, 8, capture_complete, &analysers[1]);
+
+    for(int i=0; i<ANALYSER_COUNT; i++)
+    {
+        analysers[i].buffer = capture_buf;
+        analysers[i].sample_rate = 1000.0;
+    }
 }
 
 bool process_command(uint8_t* aData, size_t aLen)
 {
+    perf_mark(PERF_COMMAND);
+
     _CMD("*idn?", 4, process_idn);
     _CMD("*opc?", 4, process_opc);
     _CMD("*esr?", 4, process_esr);
     _CMD("l:capture", 9, process_capture);
-    _CMD("l:pat", 5, process_pattern);
+    _CMD("l:acq?", 6, process_acquire);
+    _CMD("l:pat ", 6, process_pattern);
+    _CMD("l:patdata", 9, process_pattern_data);
     _CMD("rate", 4, process_rate);
     _CMD("trig", 4, process_trigger);
+    _CMD("l:inst", 6, process_instance);
+    _CMD("l:stream", 8, process_stream);
     _CMD("data?", 5, process_data);
+    _CMD("l:count?", 8, process_count);
+    _CMD("l:env?", 6, process_envelope);
+    _CMD("syst:perf?", 10, process_perf);
+    _CMD("syst:perf:res", 13, process_perf_reset);
 
     return true;
 }
@@ -46,25 +113,230 @@ void process_pattern(uint8_t const *aBuffer, size_t aLen)
     pattern = atof((char*) aBuffer + 6);
 }
 
+/*******************************************************************************************
+ * Binary block uploads, "<command> #<n><length><data>". A transport that receives the
+ * command in pieces writes the data straight into the buffer returned here as it arrives
+ * and then passes only the text up to the end of the block header to process_command().
+ * Returns NULL if the command does not take a block.
+ * *****************************************************************************************/
+uint8_t *upload_target(uint8_t const *aData, size_t aLen, size_t *max_len)
+{
+    if(aLen >= 9 && !strncasecmp("l:patdata", (char*)aData, 9))
+    {
+        *max_len = sizeof(pattern_buf);
+        return (uint8_t*)pattern_buf;
+    }
+    return NULL;
+}
+
+/*******************************************************************************************
+ * Parse a "#<n><length>" block header. Returns the header length, 0 if it is malformed.
+ * *****************************************************************************************/
+static size_t parse_block_header(uint8_t const *aData, size_t aLen, uint32_t *block_len)
+{
+    if(aLen < 2 || aData[0] != '#' || aData[1] < '1' || aData[1] > '9')
+        return 0;
+
+    size_t digits = aData[1] - '0';
+    if(aLen < 2 + digits)
+        return 0;
+
+    *block_len = 0;
+    for(size_t i=0; i<digits; i++)
+    {
+        if(aData[2 + i] < '0' || aData[2 + i] > '9')
+            return 0;
+        *block_len = *block_len * 10 + aData[2 + i] - '0';
+    }
+    return 2 + digits;
+}
+
+/*******************************************************************************************
+ * l:patdata #<n><length><data> - pattern played by l:pat 4, one sample per byte. The data
+ * is either in the command, or has already been written to pattern_buf by the transport.
+ * *****************************************************************************************/
+void process_pattern_data(uint8_t const *aBuffer, size_t aLen)
+{
+    uint8_t const *block = memchr(aBuffer, '#', aLen);
+    uint32_t len;
+    size_t header_len = block ? parse_block_header(block, aLen - (block - aBuffer), &len) : 0;
+
+    if(header_len == 0 || len > sizeof(pattern_buf))
+    {
+        status_register |= 0x00000001;
+        return;
+    }
+
+    uint8_t const *data = block + header_len;
+    if(data + len <= aBuffer + aLen)
+        memcpy(pattern_buf, data, len);
+
+    // pad the last word with its final sample
+    uint8_t *samples = (uint8_t*)pattern_buf;
+    while(len % SAMPLES_PER_WORD)
+    {
+        samples[len] = len ? samples[len - 1] : 0;
+        len++;
+    }
+    generator_set_user_pattern(pattern_buf, len / SAMPLES_PER_WORD);
+}
+
 void process_rate(uint8_t const *aBuffer, size_t aLen)
 {
-    sample_rate = atof((char*) aBuffer + 5);
+    current->sample_rate = atof((char*) aBuffer + 5);
 }
 
 void process_trigger(uint8_t const *aBuffer, size_t aLen)
 {
-    trig_channel = atof((char*) aBuffer + 5);
-    trig_type = atof((char*) aBuffer + 7);
+    current->trig_channel = atof((char*) aBuffer + 5);
+    current->trig_type = atof((char*) aBuffer + 7);
+}
+
+/*******************************************************************************************
+ * l:inst <n> - select the analyser that following rate, trig, capture and data commands
+ *              act on
+ * l:inst?    - the selected analyser
+ * *****************************************************************************************/
+void process_instance(uint8_t const *aBuffer, size_t aLen)
+{
+    if(aLen > 6 && aBuffer[6] == '?')
+    {
+        sprintf((char*)count_buf, "%d\r\n", (int)(current - analysers));
+        command_complete(count_buf, strlen((const char *)count_buf));
+        return;
+    }
+
+    int instance = atoi((char*) aBuffer + 7);
+    if(instance >= 0 && instance < ANALYSER_COUNT)
+        current = &analysers[instance];
+    else
+        status_register |= 0x00000001;
 }
 
+/*******************************************************************************************
+ * data?             - the whole capture
+ * data? start,len   - len samples from start, limited to what the DMA has written so far.
+ *                     Can be used while a capture is still running.
+ * *****************************************************************************************/
 void process_data(uint8_t const *aBuffer, size_t aLen)
 {
+    if(aLen > 6)
+    {
+        char* end;
+        uint32_t start = strtoul((char*)aBuffer + 6, &end, 10);
+        uint32_t len = *end == ',' ? strtoul(end + 1, NULL, 10) : 0;
+        process_capture_range(start, len);
+    }
+    else
         process_capture_result();
 }
 
+/*******************************************************************************************
+ * l:env? n[,start,len] - envelope of the capture for previews. For every bucket of n samples
+ * two bytes are returned: the OR and the AND of the samples in the bucket. A channel toggled
+ * within the bucket where the two differ. The bucket size is raised if needed so the reply
+ * never exceeds ENV_MAX_BUCKETS buckets.
+ * *****************************************************************************************/
+void process_envelope(uint8_t const *aBuffer, size_t aLen)
+{
+    char* end;
+    uint32_t bucket = strtoul((char*)aBuffer + 7, &end, 10);
+    uint32_t start = 0;
+    uint32_t len = 0;
+    if(*end == ',')
+    {
+        start = strtoul(end + 1, &end, 10);
+        if(*end == ',')
+            len = strtoul(end + 1, NULL, 10);
+    }
+
+    uint32_t available = captured_samples();
+    if(start > available)
+        start = available;
+    if(len == 0 || len > available - start)
+        len = available - start;
+
+    uint32_t min_bucket = (len + ENV_MAX_BUCKETS - 1) / ENV_MAX_BUCKETS;
+    bucket = tu_max32(tu_max32(bucket, min_bucket), 1);
+
+    uint8_t const *samples = (uint8_t const *)current->buffer + start;
+    size_t env_len = 0;
+    for(uint32_t i=0; i<len; i+=bucket)
+    {
+        uint32_t end_ix = i + bucket < len ? i + bucket : len;
+        uint8_t or_value = 0x00;
+        uint8_t and_value = 0xff;
+        for(uint32_t j=i; j<end_ix; j++)
+        {
+            or_value |= samples[j];
+            and_value &= samples[j];
+        }
+        env_buf[env_len++] = or_value;
+        env_buf[env_len++] = and_value;
+    }
+    send_block(env_buf, env_len);
+}
+
+/*******************************************************************************************
+ * l:stream 1 - capture continuously on the selected analyser for a streaming transport.
+ *              The stream uses the whole of capture_buf, so captures of both analysers
+ *              are dropped.
+ * l:stream 0 - stop streaming
+ * l:stream?  - running,blocks,overruns
+ * *****************************************************************************************/
+void process_stream(uint8_t const *aBuffer, size_t aLen)
+{
+    if(aLen > 8 && aBuffer[8] == '?')
+    {
+        sprintf((char*)stream_buf, "%d,%lu,%lu\r\n", stream_running(), (unsigned long)stream_blocks(), (unsigned long)stream_overruns());
+        command_complete(stream_buf, strlen((const char *)stream_buf));
+        return;
+    }
+
+    if(!atoi((char*)aBuffer + 9))
+    {
+        stream_stop();
+        return;
+    }
+
+    if(analysers[0].sampleRun || analysers[1].sampleRun || (capture_held && capture_held()))
+    {
+        status_register |= 0x00000001;
+        return;
+    }
+    for(int i=0; i<ANALYSER_COUNT; i++)
+    {
+        analysers[i].capture_words = 0;
+        analysers[i].num_samples = 0;
+    }
+
+    float sample_div = (float) clock_get_hz(clk_sys) / current->sample_rate;
+    generate_pattern(pio1, 1, pattern, GENERATOR_PIN_BASE, generator_dma_channel, 1250.0);
+    logic_analyser_init(&current->la, current->la.pin_base + current->trig_channel, current->trig_type, sample_div);
+    if(!stream_start(&current->la, capture_buf, MAX_BUFFER_SIZE))
+        status_register |= 0x00000001;
+}
+
+void process_perf(uint8_t const *aBuffer, size_t aLen)
+{
+    size_t len = perf_report((char*)perf_buf, sizeof(perf_buf));
+    command_complete(perf_buf, len);
+}
+
+void process_perf_reset(uint8_t const *aBuffer, size_t aLen)
+{
+    perf_reset();
+}
+
+void process_count(uint8_t const *aBuffer, size_t aLen)
+{
+    sprintf((char*)count_buf, "%lu\r\n", (unsigned long)captured_samples());
+    command_complete(count_buf, strlen((const char *)count_buf));
+}
+
 void process_opc(uint8_t const *aBuffer, size_t aLen)
 {
-    if(commandComplete)
+    if(current->commandComplete)
         command_complete(opc_1, strlen((const char*)opc_1));
     else
         command_complete(opc_0, strlen((const char*)opc_0));
@@ -72,75 +344,327 @@ void process_opc(uint8_t const *aBuffer, size_t aLen)
 
 void process_esr(uint8_t const *aBuffer, size_t aLen)
 {
-    if(esr_buf)
-    {
-        free(esr_buf);
-    }
-    
-    esr_buf = malloc(32);
-
-    sprintf((char*)esr_buf, "%ld\r\n", status_register);
+    sprintf((char*)esr_buf, "%lu\r\n", (unsigned long)status_register);
     command_complete((const uint8_t *)esr_buf, strlen((const char *)esr_buf));
     status_register = 0;
 }
 
 void process_capture(uint8_t const *aData, size_t aLen)
 {
-    PIO pio = pio0;
-    uint sm = 0;
-    uint pin_base = ANALYSER_PIN_BASE;
+    start_capture(atoi((char*)aData + 10));
+}
 
-    num_samples = tu_max32(atoi((char*)aData + 10), 1);
-    if(num_samples > 200000)
+/*******************************************************************************************
+ * l:acq? <n> - arm a capture of n samples and answer with the binary block once the
+ * DMA has completed. The transport holds the read until command_response_pending()
+ * returns false.
+ * *****************************************************************************************/
+void process_acquire(uint8_t const *aData, size_t aLen)
+{
+    if(current->acquirePending)
     {
-        commandComplete = true;
-        sampleRun = false;
+        // one waiter per analyser, the second would take the first one's block
         status_register |= 0x00000001;
+        command_complete(empty_block, strlen((const char*)empty_block));
+    }
+    else if(start_capture(atoi((char*)aData + 7)))
+    {
+        current->acquirePending = true;
+        current->waiter = sender;
     }
     else
     {
-        float sample_div = (float) clock_get_hz(clk_sys) / sample_rate;
-        uint trigger_pin = pin_base + trig_channel;
-        generate_pattern(pio1, 1, pattern, GENERATOR_PIN_BASE, generator_dma_channel, 1250.0);
-        printf("DMA channel %d generator_dma_channel %d\n",dma_chan, generator_dma_channel);
-        if(run_analyzer(8, num_samples, pio, sm, pin_base, sample_div, dma_chan, trigger_pin, trig_type))
+        command_complete(empty_block, strlen((const char*)empty_block));
+    }
+}
+
+bool command_response_pending()
+{
+    for(int i=0; i<ANALYSER_COUNT; i++)
+    {
+        if(analysers[i].acquirePending)
+            return true;
+    }
+    return false;
+}
+
+/*******************************************************************************************
+ * Transports with more than one client say who sent the command before process_command()
+ * and read it back in command_complete_block(). A blocking query keeps it, so the block
+ * goes to the client that asked for it when the capture completes.
+ * *****************************************************************************************/
+void set_command_sender(void *command_sender)
+{
+    sender = command_sender;
+}
+
+void *command_sender()
+{
+    return sender;
+}
+
+/*******************************************************************************************
+ * True while the sender waits for the response of a blocking query
+ * *****************************************************************************************/
+bool command_sender_waiting(void *command_sender)
+{
+    for(int i=0; i<ANALYSER_COUNT; i++)
+    {
+        if(analysers[i].acquirePending && analysers[i].waiter == command_sender)
+            return true;
+    }
+    return false;
+}
+
+/*******************************************************************************************
+ * The sender has gone or no longer wants its response, the capture carries on
+ * *****************************************************************************************/
+void command_sender_cancel(void *command_sender)
+{
+    for(int i=0; i<ANALYSER_COUNT; i++)
+    {
+        if(analysers[i].acquirePending && analysers[i].waiter == command_sender)
         {
-            sampleRun = true;
-            commandComplete = false;
+            analysers[i].acquirePending = false;
+            analysers[i].waiter = NULL;
         }
     }
+}
+
+/*******************************************************************************************
+ * Stop the captures the sender armed. Another client may have selected a different
+ * analyser since, so this is not necessarily the selected one.
+ * *****************************************************************************************/
+void command_sender_stop(void *command_sender)
+{
+    for(int i=0; i<ANALYSER_COUNT; i++)
+    {
+        if(analysers[i].owner == command_sender)
+            stop_analyser(&analysers[i]);
+    }
+}
+
+/*******************************************************************************************
+ * Make room in capture_buf for the selected analyser. A finished capture of the other
+ * analyser that is in the way is dropped, a running one makes this capture fail.
+ * *****************************************************************************************/
+static bool claim_buffer(uint32_t word_count)
+{
+    ANALYSER_T *other = current == &analysers[0] ? &analysers[1] : &analysers[0];
+
+    if(other->capture_words + word_count > MAX_BUFFER_SIZE)
+    {
+        if(other->sampleRun)
+            return false;
+        other->capture_words = 0;
+        other->num_samples = 0;
+    }
 
+    current->buffer = current == &analysers[0] ? capture_buf : capture_buf + MAX_BUFFER_SIZE - word_count;
+    return true;
+}
+
+/*******************************************************************************************
+ * For transports that drive the selected analyser directly rather than through commands
+ * *****************************************************************************************/
+void set_capture_params(float rate, uint32_t trig_channel, uint32_t trig_type)
+{
+    current->sample_rate = rate;
+    current->trig_channel = trig_channel;
+    current->trig_type = trig_type;
+}
+
+void get_capture_params(float *rate, uint32_t *trig_channel, uint32_t *trig_type)
+{
+    *rate = current->sample_rate;
+    *trig_channel = current->trig_channel;
+    *trig_type = current->trig_type;
+}
+
+bool capture_done()
+{
+    return current->commandComplete && !current->sampleRun;
+}
+
+/*******************************************************************************************
+ * Captures that have run to the end, of either analyser. A capture can start and finish
+ * between two polls of capture_done(), this count still moves.
+ * *****************************************************************************************/
+uint32_t capture_count()
+{
+    return captures_completed;
+}
+
+uint8_t const *capture_data()
+{
+    return (uint8_t const *)current->buffer;
+}
+
+/*******************************************************************************************
+ * All of capture_buf, for benchmarks that only need bytes to send
+ * *****************************************************************************************/
+uint8_t const *capture_buffer(size_t *len)
+{
+    *len = sizeof(capture_buf);
+    return (uint8_t const *)capture_buf;
+}
+
+bool capture_buffer_holds(void const *ptr)
+{
+    return (uint8_t const *)ptr >= (uint8_t const *)capture_buf &&
+           (uint8_t const *)ptr < (uint8_t const *)(capture_buf + MAX_BUFFER_SIZE);
+}
+
+static void stop_analyser(ANALYSER_T *analyser)
+{
+    if(analyser->sampleRun)
+    {
+        logic_analyser_stop(&analyser->la);
+        analyser->sampleRun = false;
+        analyser->num_samples = 0;  // a pending l:acq? gets an empty block
+        analyser->commandComplete = true;
+    }
+}
+
+void stop_capture()
+{
+    stop_analyser(current);
+}
+
+bool start_capture(int samples)
+{
+    ANALYSER_T *analyser = current;
+    uint32_t word_count = (tu_max32(samples, 1) + SAMPLES_PER_WORD - 1) / SAMPLES_PER_WORD;
+
+    // re-arming a running capture would move the DMA under it, and one still being sent
+    // would change under the transport
+    if(analyser->sampleRun || samples > MAX_SAMPLES || stream_running() ||
+       (capture_held && capture_held()) || !claim_buffer(word_count))
+    {
+        status_register |= 0x00000001;
+        return false;
+    }
+
+    analyser->num_samples = tu_max32(samples, 1);
+    float sample_div = (float) clock_get_hz(clk_sys) / analyser->sample_rate;
+    uint trigger_pin = analyser->la.pin_base + analyser->trig_channel;
+    generate_pattern(pio1, 1, pattern, GENERATOR_PIN_BASE, generator_dma_channel, 1250.0);
+    LOG_DEBUG(LOG_CAPTURE_START, analyser->la.dma_chan, generator_dma_channel);
+    if(run_analyzer(analyser, analyser->num_samples, sample_div, trigger_pin, analyser->trig_type))
+    {
+        analyser->sampleRun = true;
+        analyser->commandComplete = false;
+        analyser->owner = sender;
+    }
+    return analyser->sampleRun;
 }
 
 void analyser_task()
-{}
+{
+    for(int i=0; i<ANALYSER_COUNT; i++)
+    {
+        ANALYSER_T *analyser = &analysers[i];
 
-bool run_analyzer(uint pin_count, uint sample_count, PIO pio, uint sm, uint pin_base, float freq_div, uint dma_chan, uint trigger_pin, uint trigger_type)
+        // the PIO has no trigger interrupt, so the trigger is seen as the first DMA transfer
+        if(analyser->sampleRun && !analyser->triggerSeen && logic_analyser_words_left(&analyser->la) != analyser->capture_words)
+        {
+            analyser->triggerSeen = true;
+            perf_mark(PERF_TRIGGER);
+        }
+
+        if(analyser->acquirePending && analyser->commandComplete)
+        {
+            analyser->acquirePending = false;
+            sender = analyser->waiter;
+            analyser->waiter = NULL;
+            send_block((uint8_t*)analyser->buffer, analyser->num_samples);
+            sender = NULL;
+        }
+    }
+}
+
+static bool run_analyzer(ANALYSER_T *analyser, uint sample_count, float freq_div, uint trigger_pin, uint trigger_type)
 {
-    uint32_t word_count = ((pin_count * sample_count) + 31) / 32;
+    uint32_t word_count = ((analyser->la.pin_count * sample_count) + 31) / 32;
    
-    logic_analyser_init(pio, sm, pin_base, pin_count, trigger_pin, trigger_type, freq_div);
+    logic_analyser_init(&analyser->la, trigger_pin, trigger_type, freq_div);
 
-    logic_analyser_arm(pio, sm, dma_chan, capture_buf+2, word_count, dma_irq);
+    analyser->capture_words = word_count;
+    analyser->triggerSeen = false;
+    logic_analyser_arm(&analyser->la, analyser->buffer, word_count);
+    perf_mark(PERF_ARM);
 
     return true;
 }
 
-void dma_irq()
+static void capture_complete(LOGIC_ANALYSER_T *la)
+{
+    ANALYSER_T *analyser = la->user_data;
+
+    if(!analyser->triggerSeen)
+    {
+        analyser->triggerSeen = true;
+        perf_mark(PERF_TRIGGER);
+    }
+    perf_mark(PERF_CAPTURE_DONE);
+    analyser->commandComplete = true;
+    analyser->sampleRun = false;
+    captures_completed++;
+    if(capture_notify)
+        capture_notify();
+}
+
+/*******************************************************************************************
+ * notify is called from the DMA interrupt when a capture completes, so a transport that
+ * sleeps between events can run analyser_task() straight away
+ * *****************************************************************************************/
+void set_capture_notify(void (*notify)(void))
+{
+    capture_notify = notify;
+}
+
+/*******************************************************************************************
+ * held returns true while the transport still references capture_buf for data it sent
+ * without copying, captures and streams are refused until it returns false
+ * *****************************************************************************************/
+void set_capture_hold(bool (*held)(void))
 {
-  dma_hw->ints0 = 1u << dma_chan;
-  commandComplete = true;
-  sampleRun = false;
+    capture_held = held;
+}
+
+/*******************************************************************************************
+ * Number of samples the DMA has written so far. Only whole words are counted, so every
+ * sample reported is safe to read while the capture is still running.
+ * *****************************************************************************************/
+uint32_t captured_samples()
+{
+    if(!current->sampleRun)
+        return current->commandComplete ? current->num_samples : 0;
+
+    uint32_t words_left = logic_analyser_words_left(&current->la);
+    uint32_t samples = (current->capture_words - words_left) * SAMPLES_PER_WORD;
+    return samples < current->num_samples ? samples : current->num_samples;
 }
 
 void process_capture_result()
 {
-    char header[12];
-    uint8_t* buffer = (uint8_t*)capture_buf;
- 
-    sprintf(header, "#6%06d", num_samples);
-    for(int i=0;i<8;i++)
-        buffer[i] = header[i];
-        
-    command_complete((uint8_t*)capture_buf, 8+num_samples);
+    send_block((uint8_t*)current->buffer, current->num_samples);
+}
+
+void process_capture_range(uint32_t start, uint32_t len)
+{
+    uint32_t available = captured_samples();
+
+    if(start > available)
+        start = available;
+    if(len == 0 || len > available - start)
+        len = available - start;
+
+    send_block((uint8_t*)current->buffer + start, len);
+}
+
+void send_block(uint8_t const *data, size_t len)
+{
+    int header_len = sprintf((char*)block_header, "#6%06u", (uint)len);
+    command_complete_block(block_header, header_len, data, len);
 }
\ No newline at end of file
@@ -1,39 +1,72 @@
 #ifndef __COMMANDS__H__
 #define __COMMANDS__H__
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SAMPLES_PER_WORD 4
+#define ENV_MAX_BUCKETS 1024
+#define MAX_SAMPLES 200000
+#define PATTERN_MAX_WORDS 4096
+
+// analyser 0 runs on pio0, analyser 1 on pio1 alongside the pattern generator
+#define ANALYSER_COUNT 2
+#ifndef ANALYSER2_PIN_BASE
+    #define ANALYSER2_PIN_BASE GENERATOR_PIN_BASE
+#endif
+
 #ifdef NDEBUG
     #define MAX_BUFFER_SIZE 50002
 #else
     #define MAX_BUFFER_SIZE 50002
 #endif
 
-static const uint8_t idn[] = "Rasp Pico Logic,1.0,1001,v1.0\r\n";
-static const uint8_t opc_1[] = "1\r\n";
-static const uint8_t opc_0[] = "0\r\n";
-static bool commandComplete;
-uint32_t capture_buf[MAX_BUFFER_SIZE];
-
-uint8_t* esr_buf=0;
-volatile int num_samples = 0;
-volatile float sample_rate = 1000.0;
-volatile uint pattern=0;
-static bool sampleRun;
-static uint32_t status_register;
-uint trig_channel=0;
-uint trig_type=0;
+_Static_assert(MAX_BUFFER_SIZE * 4 <= 999999, "capture must fit a #6 block header");
+_Static_assert(2 * ENV_MAX_BUCKETS <= 999999, "envelope must fit a #6 block header");
 
 void initialise_commands();
 bool command_complete(uint8_t const *data, size_t data_len);
+bool command_complete_block(uint8_t const *header, size_t header_len, uint8_t const *data, size_t data_len);
 void process_capture_result();
+void process_capture_range(uint32_t start, uint32_t len);
+void send_block(uint8_t const *data, size_t len);
+uint32_t captured_samples();
 void process_idn(uint8_t const *aBuffer, size_t aLen);
 void process_opc(uint8_t const *aBuffer, size_t aLen);
 void process_esr(uint8_t const *aBuffer, size_t aLen);
 void process_capture(uint8_t const *aBuffer, size_t aLen);
+void process_acquire(uint8_t const *aBuffer, size_t aLen);
+bool command_response_pending();
+void set_command_sender(void *command_sender);
+void *command_sender();
+bool command_sender_waiting(void *command_sender);
+void command_sender_cancel(void *command_sender);
+void command_sender_stop(void *command_sender);
+bool start_capture(int samples);
+void stop_capture();
+void set_capture_params(float rate, uint32_t trig_channel, uint32_t trig_type);
+void get_capture_params(float *rate, uint32_t *trig_channel, uint32_t *trig_type);
+bool capture_done();
+uint32_t capture_count();
+uint8_t const *capture_data();
+uint8_t const *capture_buffer(size_t *len);
+bool capture_buffer_holds(void const *ptr);
 void process_pattern(uint8_t const *aBuffer, size_t aLen);
+void process_pattern_data(uint8_t const *aBuffer, size_t aLen);
+uint8_t *upload_target(uint8_t const *aData, size_t aLen, size_t *max_len);
 void process_rate(uint8_t const *aBuffer, size_t aLen);
 void process_trigger(uint8_t const *aBuffer, size_t aLen);
+void process_instance(uint8_t const *aBuffer, size_t aLen);
+void process_stream(uint8_t const *aBuffer, size_t aLen);
 void process_data(uint8_t const *aBuffer, size_t aLen);
+void process_count(uint8_t const *aBuffer, size_t aLen);
+void process_envelope(uint8_t const *aBuffer, size_t aLen);
+void process_perf(uint8_t const *aBuffer, size_t aLen);
+void process_perf_reset(uint8_t const *aBuffer, size_t aLen);
+bool process_command(uint8_t* aData, size_t aLen);
 void analyser_task();
-bool run_analyzer(uint pin_count, uint sample_count, PIO pio, uint sm, uint pin_base, float freq_div, uint dma_chan, uint trigger_pin, uint trigger_type);
+void set_capture_notify(void (*notify)(void));
+void set_capture_hold(bool (*held)(void));
 
 #endif
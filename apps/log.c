@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "log.h"
+
+#define LOG_SYNC_0 0xa5
+#define LOG_SYNC_1 0x5a
+
+typedef struct LOG_RECORD_T_ {
+    volatile bool ready;
+    uint8_t level;
+    uint16_t format;
+    uint32_t timestamp;
+    uint32_t args[LOG_MAX_ARGS];
+} LOG_RECORD_T;
+
+static LOG_RECORD_T log_ring[LOG_RING_SIZE];
+static volatile uint32_t log_head;
+static volatile uint32_t log_tail;
+static volatile uint32_t log_dropped;
+
+/*******************************************************************************************
+ * Add a record to the ring. The M0+ has no exclusive load/store, so the slot is claimed with
+ * interrupts held off for a handful of instructions; the record is then filled in and
+ * published with its ready flag. When the ring is full the record is dropped and counted.
+ * *****************************************************************************************/
+void log_record(uint8_t level, LOG_FORMAT_ID_T format, uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3)
+{
+    uint32_t timestamp = time_us_32();
+    uint32_t irq_state = save_and_disable_interrupts();
+    if(log_head - log_tail >= LOG_RING_SIZE)
+    {
+        log_dropped++;
+        restore_interrupts(irq_state);
+        return;
+    }
+    LOG_RECORD_T* record = &log_ring[log_head % LOG_RING_SIZE];
+    log_head++;
+    restore_interrupts(irq_state);
+
+    record->level = level;
+    record->format = format;
+    record->timestamp = timestamp;
+    record->args[0] = arg0;
+    record->args[1] = arg1;
+    record->args[2] = arg2;
+    record->args[3] = arg3;
+    __dmb();
+    record->ready = true;
+}
+
+#ifdef LOG_BINARY
+static void log_write_u32(uint8_t* buffer, uint32_t value)
+{
+    buffer[0] = value & 0xff;
+    buffer[1] = (value >> 8) & 0xff;
+    buffer[2] = (value >> 16) & 0xff;
+    buffer[3] = (value >> 24) & 0xff;
+}
+
+/*******************************************************************************************
+ * Frame layout, little endian:
+ *  0xa5 0x5a, format id (2), level (1), argument count (1), timestamp us (4), arguments (4 each)
+ * *****************************************************************************************/
+static void log_output(LOG_RECORD_T* record)
+{
+    uint8_t frame[10 + 4*LOG_MAX_ARGS];
+    frame[0] = LOG_SYNC_0;
+    frame[1] = LOG_SYNC_1;
+    frame[2] = record->format & 0xff;
+    frame[3] = record->format >> 8;
+    frame[4] = record->level;
+    frame[5] = LOG_MAX_ARGS;
+    log_write_u32(&frame[6], record->timestamp);
+    for(int i=0; i<LOG_MAX_ARGS; i++)
+        log_write_u32(&frame[10 + 4*i], record->args[i]);
+
+    for(int i=0; i<sizeof(frame); i++)
+        putchar_raw(frame[i]);
+}
+#else
+static const char* log_formats[LOG_FORMAT_COUNT] = {
+#define LOG_FORMAT(id, format) format,
+#include "log_formats.h"
+#undef LOG_FORMAT
+};
+
+static void log_output(LOG_RECORD_T* record)
+{
+    printf("[%lu] ", (unsigned long)record->timestamp);
+    printf(log_formats[record->format], record->args[0], record->args[1], record->args[2], record->args[3]);
+}
+#endif
+
+/*******************************************************************************************
+ * Drain the ring, called from the main loop when there is nothing more urgent to do.
+ * *****************************************************************************************/
+void log_task()
+{
+    while(log_tail != log_head)
+    {
+        LOG_RECORD_T* record = &log_ring[log_tail % LOG_RING_SIZE];
+        if(!record->ready)
+            break;
+        log_output(record);
+        record->ready = false;
+        log_tail++;
+    }
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+    if(log_dropped)
+    {
+        uint32_t irq_state = save_and_disable_interrupts();
+        uint32_t dropped = log_dropped;
+        log_dropped = 0;
+        restore_interrupts(irq_state);
+        LOG_WARN(LOG_DROPPED, dropped);
+    }
+#endif
+}
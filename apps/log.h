@@ -0,0 +1,71 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <stdint.h>
+
+/*******************************************************************************************
+ * Deferred logging
+ *
+ * LOG_ERROR/LOG_WARN/LOG_INFO/LOG_DEBUG(id, ...) store a small binary record (format id,
+ * timestamp and up to LOG_MAX_ARGS 32 bit arguments) in a ring. Nothing is formatted or
+ * written to the UART until log_task() drains the ring from the main loop, so the macros
+ * are cheap enough for interrupt handlers and per packet code.
+ *
+ * The format ids come from log_formats.h. Levels above LOG_LEVEL compile to nothing.
+ * With LOG_BINARY the records are written out as binary frames for python/log_decode.py,
+ * otherwise they are formatted with printf.
+ * *****************************************************************************************/
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_MAX_ARGS 4
+#define LOG_RING_SIZE 64
+
+typedef enum LOG_FORMAT_ID_T_ {
+#define LOG_FORMAT(id, format) id,
+#include "log_formats.h"
+#undef LOG_FORMAT
+    LOG_FORMAT_COUNT
+} LOG_FORMAT_ID_T;
+
+void log_record(uint8_t level, LOG_FORMAT_ID_T format, uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3);
+void log_task();
+
+// pad the arguments out to LOG_MAX_ARGS
+#define LOG_AT(level, ...) LOG_AT_(level, __VA_ARGS__, 0, 0, 0, 0)
+#define LOG_AT_(level, format, a0, a1, a2, a3, ...) \
+    log_record(level, format, (uint32_t)(a0), (uint32_t)(a1), (uint32_t)(a2), (uint32_t)(a3))
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+/*******************************************************************************************
+ * Log record formats - LOG_FORMAT(id, printf format)
+ *
+ * Every argument is logged as a 32 bit value, so formats may only use integer conversions
+ * and at most LOG_MAX_ARGS of them. python/log_decode.py parses this file to decode binary
+ * logs, so decode with the same revision as the firmware.
+ * *****************************************************************************************/
+LOG_FORMAT(LOG_DROPPED,             "log: %u records dropped\n")
+LOG_FORMAT(LOG_CAPTURE_START,       "Capture dma channel %d generator dma channel %d\n")
+LOG_FORMAT(LOG_PCB_FAILED,          "failed to create pcb\n")
+LOG_FORMAT(LOG_BIND_FAILED,         "failed to bind to port %d\n")
+LOG_FORMAT(LOG_LISTEN_FAILED,       "failed to listen\n")
+LOG_FORMAT(LOG_ACCEPT_FAILED,       "Failure in accept %d\n")
+LOG_FORMAT(LOG_CLIENT_CONNECTED,    "Client connected\n")
+LOG_FORMAT(LOG_TCP_SENT,            "tcp_server_sent %u\n")
+LOG_FORMAT(LOG_TCP_EOF,             "EOF\n")
+LOG_FORMAT(LOG_TCP_RECV,            "tcp_server_recv %d, %d buffered, err %d\n")
+LOG_FORMAT(LOG_RPC_TOO_LARGE,       "%d RPC records too large, dropped\n")
+LOG_FORMAT(LOG_RPC_SHORT,           "RPC record of %d bytes too short\n")
+LOG_FORMAT(LOG_TCP_RECV_HELD,       "Holding %d bytes until the reply has been sent\n")
+LOG_FORMAT(LOG_TCP_QUEUED,          "Reply part %d of %d, %d bytes of send buffer left\n")
+LOG_FORMAT(LOG_TCP_CLOSE_WAIT,      "CLOSE_WAIT\n")
+LOG_FORMAT(LOG_TCP_ERR,             "tcp_client_err_fn %d\n")
+LOG_FORMAT(LOG_RPC_CALL,            "RPC CALL: xid=0x%08x program=%d procedure=%d portmap prog=%d\n")
+LOG_FORMAT(LOG_PORTMAP_GETADDR,     "GETADDR %d\n")
+LOG_FORMAT(LOG_PORTMAP_GETPORT,     "GETPORT %d\n")
+LOG_FORMAT(LOG_MDNS_FAILED,         "mDNS responder failed %d\n")
+LOG_FORMAT(LOG_UDP_STREAM,          "UDP stream to port %d\n")
+LOG_FORMAT(LOG_UDP_STREAM_ADDRESS,  "Bad UDP stream address\n")
+LOG_FORMAT(LOG_UDP_STREAM_PORT,     "Bad UDP stream port\n")
+LOG_FORMAT(LOG_CONFIG_FULL,         "No room in the config store for key %d\n")
+LOG_FORMAT(LOG_CONFIG_PRESET,       "No preset %d\n")
+LOG_FORMAT(LOG_WIFI_STATIC,         "Bad static address, expected ip,mask,gateway\n")
+LOG_FORMAT(LOG_RPC_UNKNOWN,         "Unknown call prog %d -> procedure %d\n")
+LOG_FORMAT(LOG_STRING_DECODED,      "Decoded string len=%d\n")
+LOG_FORMAT(LOG_TCP_WRITE_FAILED,    "Failed to write data %d\n")
+LOG_FORMAT(LOG_VXI_CREATE_LINK,     "CREATE LINK %d monitor %d lock %d\n")
+LOG_FORMAT(LOG_VXI_DESTROY_LINK,    "DESTROY LINK %d\n")
+LOG_FORMAT(LOG_VXI_INVALID_LINK,    "Invalid link %d for procedure %d\n")
+LOG_FORMAT(LOG_VXI_LOCK_DEFERRED,   "Link %d waiting %d ms for the lock\n")
+LOG_FORMAT(LOG_VXI_DEVICE_WRITE,    "DEVICE WRITE %d bytes\n")
+LOG_FORMAT(LOG_VXI_DEVICE_READ,     "DEVICE READ link %d size %d io timeout %d lock timeout %d\n")
+LOG_FORMAT(LOG_VXI_READ_DEFERRED,   "Deferring read for %d ms\n")
+LOG_FORMAT(LOG_VXI_READ_TIMEOUT,    "Deferred read timed out\n")
+LOG_FORMAT(LOG_VXI_READ_REPLY,      "Sending %d bytes from %d of %d, %d fill bytes\n")
+LOG_FORMAT(LOG_VXI_CLEAR,           "Clearing link %d\n")
+LOG_FORMAT(LOG_VXI_WRITE_DROPPED,   "Link %d: command too long or bad block header, dropped\n")
+LOG_FORMAT(LOG_SCPI_CONNECTED,      "SCPI client connected, link %d\n")
+LOG_FORMAT(LOG_SCPI_LINE_DROPPED,   "SCPI link %d: command too long or bad block header, dropped\n")
+LOG_FORMAT(LOG_SCPI_BLOCK_LOST,      "SCPI link %d: block without a length, connection closed\n")
+LOG_FORMAT(LOG_SCPI_LOCKED,         "SCPI link %d: device locked by another link, command dropped\n")
+LOG_FORMAT(LOG_HISLIP_SESSION,      "HiSLIP session %d, link %d, client protocol 0x%04x\n")
+LOG_FORMAT(LOG_HISLIP_CLOSED,       "HiSLIP session %d closed\n")
+LOG_FORMAT(LOG_HISLIP_MESSAGE,      "HiSLIP message %d control %d parameter 0x%08x\n")
+LOG_FORMAT(LOG_HISLIP_ERROR,        "HiSLIP error %d\n")
+LOG_FORMAT(LOG_HISLIP_CLEAR,        "HiSLIP session %d device clear\n")
+LOG_FORMAT(LOG_HISLIP_LOCK_WAIT,    "HiSLIP session %d waiting %d ms for the lock\n")
+LOG_FORMAT(LOG_SESSION_FULL,        "No free session, connection refused\n")
+LOG_FORMAT(LOG_LINK_REPLY_DROPPED,  "Link %d: no room to keep a %d byte reply, dropped\n")
+LOG_FORMAT(LOG_SERVER_FAILED,       "Failed to run\n")
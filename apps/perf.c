@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "perf.h"
+
+typedef struct PERF_RECORD_T_ {
+    uint32_t timestamp;
+    PERF_EVENT_T event;
+} PERF_RECORD_T;
+
+typedef struct PERF_STATS_T_ {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} PERF_STATS_T;
+
+static const char* perf_names[PERF_EVENT_COUNT] = {
+    "command",
+    "arm",
+    "trigger",
+    "capture",
+    "tx_first",
+    "tx_last",
+};
+
+// the event each one is measured from
+static const PERF_EVENT_T perf_reference[PERF_EVENT_COUNT] = {
+    PERF_COMMAND,
+    PERF_COMMAND,
+    PERF_ARM,
+    PERF_TRIGGER,
+    PERF_COMMAND,
+    PERF_TX_FIRST,
+};
+
+static PERF_RECORD_T perf_ring[PERF_RING_SIZE];
+static uint perf_ring_next;
+static uint32_t perf_last[PERF_EVENT_COUNT];
+static bool perf_seen[PERF_EVENT_COUNT];
+static PERF_STATS_T perf_stats[PERF_EVENT_COUNT];
+
+/*******************************************************************************************
+ * Record an instrumentation point. Safe to call from interrupt handlers, interrupts are
+ * only held off for the few instructions needed to update the ring and the stats.
+ * *****************************************************************************************/
+void perf_mark(PERF_EVENT_T event)
+{
+    uint32_t now = time_us_32();
+    uint32_t irq_state = save_and_disable_interrupts();
+
+    perf_ring[perf_ring_next].timestamp = now;
+    perf_ring[perf_ring_next].event = event;
+    perf_ring_next = (perf_ring_next + 1) % PERF_RING_SIZE;
+
+    PERF_EVENT_T reference = perf_reference[event];
+    if(reference != event && perf_seen[reference])
+    {
+        uint32_t elapsed = now - perf_last[reference];
+        PERF_STATS_T* stats = &perf_stats[event];
+        if(stats->count == 0 || elapsed < stats->min)
+            stats->min = elapsed;
+        if(elapsed > stats->max)
+            stats->max = elapsed;
+        stats->total += elapsed;
+        stats->count++;
+    }
+    perf_last[event] = now;
+    perf_seen[event] = true;
+
+    restore_interrupts(irq_state);
+}
+
+void perf_reset()
+{
+    uint32_t irq_state = save_and_disable_interrupts();
+    memset(perf_ring, 0, sizeof(perf_ring));
+    memset(perf_stats, 0, sizeof(perf_stats));
+    memset(perf_seen, 0, sizeof(perf_seen));
+    perf_ring_next = 0;
+    restore_interrupts(irq_state);
+}
+
+/*******************************************************************************************
+ * Text report for SYST:PERF?
+ * One line per event with "name,from,count,min_us,avg_us,max_us" followed by the most recent
+ * events from the ring, oldest first, as "name,timestamp_us".
+ * *****************************************************************************************/
+size_t perf_report(char* buffer, size_t buffer_len)
+{
+    size_t len = 0;
+    PERF_STATS_T stats[PERF_EVENT_COUNT];
+    PERF_RECORD_T ring[PERF_RING_SIZE];
+    uint ring_next;
+
+    uint32_t irq_state = save_and_disable_interrupts();
+    memcpy(stats, perf_stats, sizeof(stats));
+    memcpy(ring, perf_ring, sizeof(ring));
+    ring_next = perf_ring_next;
+    restore_interrupts(irq_state);
+
+    for(int i=0; i<PERF_EVENT_COUNT && len < buffer_len; i++)
+    {
+        uint32_t avg = stats[i].count ? (uint32_t)(stats[i].total / stats[i].count) : 0;
+        len += snprintf(buffer + len, buffer_len - len, "%s,%s,%lu,%lu,%lu,%lu\n",
+                        perf_names[i], perf_names[perf_reference[i]],
+                        (unsigned long)stats[i].count, (unsigned long)stats[i].min,
+                        (unsigned long)avg, (unsigned long)stats[i].max);
+    }
+
+    for(int i=0; i<PERF_RING_SIZE && len < buffer_len; i++)
+    {
+        PERF_RECORD_T* record = &ring[(ring_next + i) % PERF_RING_SIZE];
+        if(record->timestamp == 0)
+            continue;
+        len += snprintf(buffer + len, buffer_len - len, "%s,%lu\n",
+                        perf_names[record->event], (unsigned long)record->timestamp);
+    }
+
+    return len < buffer_len ? len : buffer_len - 1;
+}
@@ -0,0 +1,27 @@
+#ifndef __PERF_H__
+#define __PERF_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PERF_RING_SIZE 32
+
+/*******************************************************************************************
+ * Hot path instrumentation points. Each one is timed against the reference event listed
+ * in perf.c, e.g. PERF_TRIGGER is the time from arming to the first sample.
+ * *****************************************************************************************/
+typedef enum PERF_EVENT_T_ {
+    PERF_COMMAND,       // command received by process_command()
+    PERF_ARM,           // logic_analyser_arm() called
+    PERF_TRIGGER,       // first sample written by the DMA
+    PERF_CAPTURE_DONE,  // dma_irq()
+    PERF_TX_FIRST,      // first byte of a response handed to the transport
+    PERF_TX_LAST,       // last byte of a response handed to the transport
+    PERF_EVENT_COUNT
+} PERF_EVENT_T;
+
+void perf_mark(PERF_EVENT_T event);
+void perf_reset();
+size_t perf_report(char* buffer, size_t buffer_len);
+
+#endif
@@ -0,0 +1,90 @@
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "logic_analyser.h"
+#include "stream.h"
+
+static LOGIC_ANALYSER_T *stream_analyser;
+static int stream_dma_chan = -1;
+static uint32_t blocks_read;
+static uint32_t overruns;
+
+/*******************************************************************************************
+ * Start streaming from an analyser whose capture program has been loaded. The ring is
+ * cut into as many whole blocks as fit, there must be room for at least 4.
+ * *****************************************************************************************/
+bool stream_start(LOGIC_ANALYSER_T *analyser, uint32_t *ring, size_t ring_words)
+{
+    uint block_count = (ring_words / STREAM_BLOCK_WORDS) & ~1u;
+    if(block_count < 4)
+        return false;
+
+    if(stream_dma_chan < 0)
+        stream_dma_chan = dma_claim_unused_channel(true);
+
+    stream_stop();
+    blocks_read = 0;
+    overruns = 0;
+    stream_analyser = analyser;
+    logic_analyser_stream(analyser, stream_dma_chan, ring, STREAM_BLOCK_WORDS, block_count, NULL);
+    return true;
+}
+
+void stream_stop()
+{
+    if(stream_analyser)
+        logic_analyser_stop(stream_analyser);
+    stream_analyser = NULL;
+}
+
+bool stream_running()
+{
+    return stream_analyser != NULL;
+}
+
+/*******************************************************************************************
+ * The oldest block not yet taken, or NULL if the DMA has not finished another one. The
+ * same block is returned until it is released. If the transport fell behind, the blocks
+ * the DMA is about to overwrite are skipped.
+ * *****************************************************************************************/
+uint8_t const *stream_claim_block()
+{
+    if(!stream_analyser)
+        return NULL;
+
+    uint32_t written = stream_analyser->blocks_written;
+    uint32_t safe = stream_analyser->block_count - 2;
+    if(written - blocks_read > safe)
+    {
+        overruns += written - blocks_read - safe;
+        blocks_read = written - safe;
+    }
+    if(blocks_read == written)
+        return NULL;
+
+    uint block = blocks_read % stream_analyser->block_count;
+    return (uint8_t const *)(stream_analyser->ring + block * STREAM_BLOCK_WORDS);
+}
+
+void stream_release_block()
+{
+    blocks_read++;
+}
+
+/*******************************************************************************************
+ * Number of the block stream_claim_block() returns, counted from the start of the stream
+ * with the skipped blocks, so a jump in it shows where blocks were lost
+ * *****************************************************************************************/
+uint32_t stream_block_number()
+{
+    return blocks_read;
+}
+
+uint32_t stream_blocks()
+{
+    return stream_analyser ? stream_analyser->blocks_written : 0;
+}
+
+uint32_t stream_overruns()
+{
+    return overruns;
+}
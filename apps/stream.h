@@ -0,0 +1,27 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "logic_analyser.h"
+
+// 4 KB blocks, about 8 ms of 8 channels at 500 kHz
+#define STREAM_BLOCK_WORDS 1024
+#define STREAM_BLOCK_BYTES (STREAM_BLOCK_WORDS * 4)
+
+/*******************************************************************************************
+ * Continuous capture for the streaming transports. The analyser fills a ring of blocks
+ * and a transport takes them in order with stream_claim_block() / stream_release_block().
+ * A transport that falls behind loses the oldest blocks, they are counted as overruns.
+ * *****************************************************************************************/
+bool stream_start(LOGIC_ANALYSER_T *analyser, uint32_t *ring, size_t ring_words);
+void stream_stop();
+bool stream_running();
+uint8_t const *stream_claim_block();
+void stream_release_block();
+uint32_t stream_block_number();
+uint32_t stream_blocks();
+uint32_t stream_overruns();
+
+#endif
@@ -30,6 +30,10 @@
 #include "bsp/board.h"
 #include "tusb.h"
 #include "usbtmc_app.h"
+#include "vendor_stream.h"
+#include "sump.h"
+#include "log.h"
+#include "commands.h"
 #include "hardware/timer.h"
 #include "pico/stdlib.h"
 
@@ -50,8 +54,6 @@ enum  {
 
 static uint32_t blink_interval_ms = BLINK_NOT_MOUNTED;
 
-void analyser_task();
-
 void led_blinking_task(void);
 const uint LED_PIN = 25;
 
@@ -63,13 +65,17 @@ int main(void)
   gpio_set_dir(LED_PIN, GPIO_OUT);
 
   tusb_init();
+  initialise_commands();
 
   while (1)
   {
     tud_task(); // tinyusb device task
     led_blinking_task();
     usbtmc_app_task_iter();
+    vendor_stream_task();
+    sump_task();
     analyser_task();
+    log_task();
   }
 
   return 0;
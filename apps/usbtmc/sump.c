@@ -0,0 +1,186 @@
+/*
+ * SUMP / Openbench Logic Sniffer protocol on the CDC interface
+ *
+ * Lets sigrok and PulseView use their "Openbench Logic Sniffer & SUMP compatibles"
+ * driver on the serial port directly. The SUMP settings are mapped onto the selected
+ * analyser:
+ *
+ *   divider       rate = 100 MHz / (divider + 1)
+ *   read count    samples captured, (count + 1) * 4
+ *   trigger       stage 0 mask/value, the lowest channel in the mask becomes a level
+ *                 trigger on that channel. The capture starts at the trigger, there are
+ *                 no pre-trigger samples, so the delay count is ignored.
+ *
+ * Only channel group 0 (8 channels) is captured, so a sample is one byte. As the
+ * protocol expects, samples are sent newest first. SUMP has no way to report an error,
+ * a capture the analyser refuses is answered with the samples the client waits for,
+ * all zero.
+ */
+
+#include "tusb.h"
+#include "commands.h"
+#include "sump.h"
+
+#define SUMP_RESET          0x00
+#define SUMP_RUN            0x01
+#define SUMP_ID             0x02
+#define SUMP_METADATA       0x04
+#define SUMP_XON            0x11
+#define SUMP_XOFF           0x13
+#define SUMP_DIVIDER        0x80
+#define SUMP_READ_DELAY     0x81
+#define SUMP_FLAGS          0x82
+#define SUMP_TRIGGER_MASK   0xc0
+#define SUMP_TRIGGER_VALUE  0xc1
+#define SUMP_TRIGGER_CONFIG 0xc2
+
+#define SUMP_CLOCK          100000000.0f
+
+// trigger types of the PIO capture program
+#define TRIGGER_OFF         0
+#define TRIGGER_LOW_LEVEL   1
+#define TRIGGER_HIGH_LEVEL  2
+
+static uint8_t const sump_id[] = "1ALS";
+
+static uint8_t const sump_metadata[] = {
+  0x01, 'P', 'i', 'c', 'o', ' ', 'L', 'o', 'g', 'i', 'c', 0x00,   // device name
+  0x02, '1', '.', '0', 0x00,                                      // firmware version
+  0x21, (MAX_SAMPLES >> 24) & 0xff, (MAX_SAMPLES >> 16) & 0xff,   // sample memory
+        (MAX_SAMPLES >> 8) & 0xff, MAX_SAMPLES & 0xff,
+  0x23, 0x05, 0xf5, 0xe1, 0x00,                                   // max sample rate, 100 MHz
+  0x40, 8,                                                        // probes
+  0x41, 2,                                                        // protocol version
+  0x00
+};
+
+static uint8_t cmd[5];
+static size_t cmd_len;
+
+static uint32_t divider = 99;       // 1 MHz
+static uint32_t read_count = 4096;
+static uint8_t trigger_mask;
+static uint8_t trigger_value;
+
+static bool running;
+static uint8_t const *tx_data;     // NULL for a refused capture, zeros are sent
+static size_t tx_left;              // samples still to send, sent from the end backwards
+static bool xoff;
+
+static void sump_send(uint8_t const *data, size_t len)
+{
+  tud_cdc_write(data, len);
+  tud_cdc_write_flush();
+}
+
+static void sump_run(void)
+{
+  uint32_t trig_channel = 0;
+  uint32_t trig_type = TRIGGER_OFF;
+
+  if(trigger_mask)
+  {
+    while(!(trigger_mask & (1u << trig_channel)))
+      trig_channel++;
+    trig_type = (trigger_value & (1u << trig_channel)) ? TRIGGER_HIGH_LEVEL : TRIGGER_LOW_LEVEL;
+  }
+
+  set_capture_params(SUMP_CLOCK / (float)(divider + 1), trig_channel, trig_type);
+  tx_left = 0;
+  running = start_capture((int)read_count);
+  if(!running)
+  {
+    // the client reads read_count samples whatever happens, or times out
+    tx_data = NULL;
+    tx_left = read_count;
+  }
+}
+
+static void sump_command(uint8_t const *c)
+{
+  uint32_t value = c[1] | (c[2] << 8) | (c[3] << 16) | ((uint32_t)c[4] << 24);
+
+  switch(c[0])
+  {
+  case SUMP_RESET:
+    if(running)
+      stop_capture();
+    running = false;
+    tx_left = 0;
+    break;
+  case SUMP_RUN:
+    // a capture already running is left alone, clients abort it with a reset
+    if(!running)
+      sump_run();
+    break;
+  case SUMP_ID:
+    sump_send(sump_id, 4);
+    break;
+  case SUMP_METADATA:
+    sump_send(sump_metadata, sizeof(sump_metadata));
+    break;
+  case SUMP_XON:
+    xoff = false;
+    break;
+  case SUMP_XOFF:
+    xoff = true;
+    break;
+  case SUMP_DIVIDER:
+    divider = value & 0xffffff;
+    break;
+  case SUMP_READ_DELAY:
+    read_count = ((value & 0xffff) + 1) * 4;
+    if(read_count > MAX_SAMPLES)
+      read_count = MAX_SAMPLES;
+    break;
+  case SUMP_TRIGGER_MASK:
+    trigger_mask = value & 0xff;
+    break;
+  case SUMP_TRIGGER_VALUE:
+    trigger_value = value & 0xff;
+    break;
+  default:
+    // flags and the other trigger stages are accepted and ignored
+    break;
+  }
+}
+
+static void sump_send_samples(void)
+{
+  uint8_t chunk[64];
+
+  while(tx_left && !xoff)
+  {
+    size_t len = tu_min32(tu_min32(tud_cdc_write_available(), sizeof(chunk)), tx_left);
+    if(len == 0)
+      break;
+    for(size_t i=0; i<len; i++)
+      chunk[i] = tx_data ? tx_data[tx_left - 1 - i] : 0;
+    tx_left -= len;
+    tud_cdc_write(chunk, len);
+  }
+  tud_cdc_write_flush();
+}
+
+void sump_task(void)
+{
+  while(tud_cdc_available())
+  {
+    cmd[cmd_len++] = (uint8_t)tud_cdc_read_char();
+    // long commands have four bytes of parameters
+    if((cmd[0] & 0x80) && cmd_len < sizeof(cmd))
+      continue;
+    sump_command(cmd);
+    cmd_len = 0;
+  }
+
+  if(running && capture_done())
+  {
+    running = false;
+    tx_data = capture_data();
+    tx_left = captured_samples();
+  }
+
+  if(tx_left)
+    sump_send_samples();
+}
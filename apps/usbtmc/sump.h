@@ -0,0 +1,6 @@
+#ifndef SUMP_H
+#define SUMP_H
+
+void sump_task(void);
+
+#endif
@@ -78,6 +78,17 @@
 #define CFG_TUD_USBTMC_ENABLE_INT_EP  1
 #define CFG_TUD_USBTMC_ENABLE_488     1
 
+// SUMP protocol for sigrok / PulseView, see sump.c
+#define CFG_TUD_CDC                   1
+#define CFG_TUD_CDC_RX_BUFSIZE        64
+#define CFG_TUD_CDC_TX_BUFSIZE        1024
+
+// raw sample stream, see vendor_stream.c
+#define CFG_TUD_VENDOR                1
+#define CFG_TUD_VENDOR_EPSIZE         64
+#define CFG_TUD_VENDOR_RX_BUFSIZE     64
+#define CFG_TUD_VENDOR_TX_BUFSIZE     2048
+
 #ifdef __cplusplus
  }
 #endif
@@ -28,6 +28,8 @@
 #include "tusb.h"
 #include "bsp/board.h"
 #include "main.h"
+#include "perf.h"
+#include "commands.h"
 
 #if (CFG_TUD_USBTMC_ENABLE_488)
 static usbtmc_response_capabilities_488_t const
@@ -76,7 +78,8 @@ uint8_t count = 0;
 static volatile uint8_t status;
 
 // 0=not query, 1=queried, 2=delay,set(MAV), 3=delay 4=ready?
-// (to simulate delay)
+// The delay states are only used when a response delay has been set for testing
+// ("delay <ms>"), otherwise the response is sent as soon as it is ready.
 enum  _states {
   QStart = 0,
   QDelayStart,
@@ -93,18 +96,28 @@ static volatile uint32_t bulkInStarted;
 static volatile uint32_t iCmdResponse;
 static uint8_t const *iCmdResponseBuf;
 static size_t iCmdResponseBufLen;
+static uint8_t const *iCmdResponseHeader;
+static size_t iCmdResponseHeaderLen;
+static size_t iCmdResponseTxIx;        // bytes of iCmdResponseBuf already sent
+static bool iCmdResponseHeaderSent;
+static volatile bool iCmdResponseMore; // part sent, the rest follows on the next Bulk-IN request
 
 //static volatile uint32_t waveQuery;
 
-static uint32_t resp_delay = 125u; // Adjustable delay, to allow for better testing
+static uint32_t resp_delay = 0u; // Adjustable delay, to allow for better testing
 static size_t buffer_len;
 static size_t buffer_tx_ix; // for transmitting using multiple transfers
 static uint8_t buffer[225]; // A few packets long should be enough.
 
+// binary block upload in progress, the payload goes straight to upload_buf
+static uint8_t *upload_buf;
+static size_t upload_max;
+static size_t upload_len;
+static size_t upload_ix;
+static size_t block_start;  // offset of the '#' in buffer, 0 if none
+
 //uint32_t *capture_buf = 0;
 
-bool process_command(uint8_t* aData, size_t aLen);
-bool command_complete();
 
 static usbtmc_msg_dev_dep_msg_in_header_t rspMsg = {
     .bmTransferAttributes =
@@ -142,26 +155,70 @@ bool tud_usbtmc_msgBulkOut_start_cb(usbtmc_msg_request_dev_dep_out const * msgHe
 {
   (void)msgHeader;
   buffer_len = 0;
-  if(msgHeader->TransferSize > sizeof(buffer))
+  upload_buf = NULL;
+  upload_len = 0;
+  upload_ix = 0;
+  block_start = 0;
+  // the size is checked as the data arrives, only a binary block may exceed the buffer
+  return true;
+}
+
+/*
+ * Collect the command text in buffer. When the command takes a binary block (see
+ * upload_target()) and its "#<n><length>" header is complete, the rest of the transfer
+ * is written straight to the upload buffer, packet by packet, without going through
+ * buffer. Anything after the block, e.g. a newline, is dropped.
+ */
+static bool receive_command(uint8_t const *data, size_t len)
+{
+  while(len)
   {
+    if(upload_buf)
+    {
+      size_t n = tu_min32(len, upload_len - upload_ix);
+      memcpy(&upload_buf[upload_ix], data, n);
+      upload_ix += n;
+      return true;
+    }
 
-    return false;
+    if(buffer_len + 1 >= sizeof(buffer))
+      return false; // buffer overflow!
+    uint8_t c = *data++;
+    len--;
+    buffer[buffer_len++] = c;
+
+    if(c == '#' && !block_start && upload_target(buffer, buffer_len, &upload_max))
+    {
+      block_start = buffer_len - 1;
+    }
+    else if(block_start && buffer_len == block_start + 2)
+    {
+      if(c < '1' || c > '9')
+        return false; // indefinite length blocks are not supported
+    }
+    else if(block_start && buffer_len == block_start + 2 + (buffer[block_start + 1] - '0'))
+    {
+      upload_len = 0;
+      for(size_t i = block_start + 2; i < buffer_len; i++)
+      {
+        if(buffer[i] < '0' || buffer[i] > '9')
+          return false;
+        upload_len = upload_len * 10 + (buffer[i] - '0');
+      }
+      if(upload_len > upload_max)
+        return false;
+      upload_buf = upload_target(buffer, buffer_len, &upload_max);
+      upload_ix = 0;
+    }
   }
   return true;
 }
 
 bool tud_usbtmc_msg_data_cb(void *data, size_t len, bool transfer_complete)
 {
-  // If transfer isn't finished, we just ignore it (for now)
-
-  if(len + buffer_len < sizeof(buffer))
+  if(!receive_command(data, len))
   {
-    memcpy(&(buffer[buffer_len]), data, len);
-    buffer_len += len;
-  }
-  else
-  {
-    return false; // buffer overflow!
+    return false; // buffer overflow or bad block header
   }
   if(transfer_complete)
     queryState = QDelayStart;
@@ -170,16 +227,22 @@ bool tud_usbtmc_msg_data_cb(void *data, size_t len, bool transfer_complete)
   //queryState = transfer_complete;
   
   iCmdResponse = 0;
+  iCmdResponseMore = false;
+  iCmdResponseTxIx = 0;
+  iCmdResponseHeaderSent = false;
+
+  buffer[buffer_len] = 0; // receive_command() always leaves room for the terminator
 
-  if (transfer_complete)
+  // a block that ended early is not handed on
+  if (transfer_complete && (!upload_buf || upload_ix == upload_len))
   {
-    process_command(data, len);
+    process_command(buffer, buffer_len);
   }
 
-  if(transfer_complete && !strncasecmp("delay ",data,5))
+  if(transfer_complete && buffer_len >= 6 && !strncasecmp("delay ",(char*)buffer,6))
   {
     queryState = QStart;
-    int d = atoi((char*)data + 5);
+    int d = atoi((char*)buffer + 6);
     if(d > 10000)
       d = 10000;
     if(d<0)
@@ -192,7 +255,12 @@ bool tud_usbtmc_msg_data_cb(void *data, size_t len, bool transfer_complete)
 
 bool tud_usbtmc_msgBulkIn_complete_cb()
 {
-  if((buffer_tx_ix == buffer_len) || iCmdResponse) // done
+  if(iCmdResponseMore)
+  {
+    // wait for the next Bulk-IN request to send the rest of the response
+    bulkInStarted = 0;
+  }
+  else if((buffer_tx_ix == buffer_len) || iCmdResponse) // done
   {
     status &= (uint8_t)~(IEEE4882_STB_MAV); // clear MAV
     queryState = QStart;
@@ -237,9 +305,56 @@ bool tud_usbtmc_msgBulkIn_request_cb(usbtmc_msg_request_dev_dep_in const * reque
 
 bool command_complete(uint8_t const *aBuffer, size_t aLen)
 {
+  return command_complete_block(NULL, 0, aBuffer, aLen);
+}
+
+bool command_complete_block(uint8_t const *aHeader, size_t aHeaderLen, uint8_t const *aBuffer, size_t aLen)
+{
+  iCmdResponseHeader = aHeader;
+  iCmdResponseHeaderLen = aHeaderLen;
   iCmdResponseBuf = aBuffer;
   iCmdResponseBufLen = aLen;
+  iCmdResponseTxIx = 0;
+  iCmdResponseHeaderSent = false;
   iCmdResponse = 1;
+  return true;
+}
+
+/*
+ * Send the next part of a command response for the current Bulk-IN request. The
+ * response is streamed from where it lies, e.g. capture_buf, over as many requests as
+ * the host needs: the block header goes first in its own transfer, then the data in
+ * chunks of at most the requested size. EOM is only set on the last one.
+ */
+static void send_response_part(void)
+{
+  uint8_t const *data;
+  size_t len;
+
+  if(!iCmdResponseMore)
+    perf_mark(PERF_TX_FIRST);
+
+  if(iCmdResponseHeaderLen && !iCmdResponseHeaderSent)
+  {
+    data = iCmdResponseHeader;
+    len = iCmdResponseHeaderLen;
+    iCmdResponseHeaderSent = true;
+  }
+  else
+  {
+    data = iCmdResponseBuf + iCmdResponseTxIx;
+    len = tu_min32(iCmdResponseBufLen - iCmdResponseTxIx, msgReqLen);
+    iCmdResponseTxIx += len;
+  }
+
+  iCmdResponseMore = iCmdResponseTxIx < iCmdResponseBufLen;
+  tud_usbtmc_transmit_dev_msg_data(data, len, !iCmdResponseMore, false);
+  if(!iCmdResponseMore)
+  {
+    perf_mark(PERF_TX_LAST);
+    queryState = QStart;
+  }
+  bulkInStarted = 0;
 }
 
 void usbtmc_app_task_iter(void) {
@@ -251,7 +366,20 @@ void usbtmc_app_task_iter(void) {
     queryState = QDelayRun;
     break;
   case QDelayRun:
-    if( (board_millis() - queryDelayStart) > resp_delay) {
+    if(resp_delay == 0u) {
+      // a blocking query (e.g. l:acq?) has no response until its capture is done
+      if(command_response_pending())
+        break;
+      if(iCmdResponse) {
+        status |= IEEE4882_STB_MAV;
+        status |= IEEE4882_STB_SRQ;
+        queryState = QSendResult;
+      }
+      else {
+        queryState = QStart; // nothing to send, keep NAKing the Bulk-IN
+      }
+    }
+    else if( (board_millis() - queryDelayStart) > resp_delay && !command_response_pending()) {
       queryDelayStart = board_millis();
       queryState=QDelayEnd;
       status |= 0x10u; // MAV
@@ -264,13 +392,13 @@ void usbtmc_app_task_iter(void) {
     }
     break;
   case QSendResult: // time to transmit;
+    // a blocking query (e.g. l:acq?) is still waiting for its capture, keep NAKing the Bulk-IN
+    if(command_response_pending())
+      break;
     if(bulkInStarted && (buffer_tx_ix == 0)) {
       if(iCmdResponse)
       {
-        size_t tx_len = tu_min32(iCmdResponseBufLen, msgReqLen);
-        tud_usbtmc_transmit_dev_msg_data(iCmdResponseBuf,  tx_len,true,false);
-        queryState = QStart;
-        bulkInStarted = 0;
+        send_response_part();
       }
       else
       {
@@ -300,6 +428,8 @@ bool tud_usbtmc_check_clear_cb(usbtmc_get_clear_status_rsp_t *rsp)
   queryState = QStart;
   bulkInStarted = false;
   status = 0;
+  iCmdResponse = 0;
+  iCmdResponseMore = false;
   buffer_tx_ix = 0u;
   buffer_len = 0u;
   rsp->USBTMC_status = USBTMC_STATUS_SUCCESS;
@@ -309,6 +439,9 @@ bool tud_usbtmc_check_clear_cb(usbtmc_get_clear_status_rsp_t *rsp)
 bool tud_usbtmc_initiate_abort_bulk_in_cb(uint8_t *tmcResult)
 {
   bulkInStarted = 0;
+  iCmdResponse = 0;
+  iCmdResponseMore = false;
+  queryState = QStart;
   *tmcResult = USBTMC_STATUS_SUCCESS;
   return true;
 }
@@ -0,0 +1,51 @@
+/*
+ * Raw sample stream on the vendor interface
+ *
+ * Streaming is started and stopped with "l:stream 1" / "l:stream 0" on the USBTMC
+ * interface. While it runs the blocks of the ring are written to the vendor Bulk-IN
+ * endpoint as they fill, without any framing, so the host reads a continuous byte
+ * stream of one sample per byte. Blocks the host was too slow for are dropped and
+ * counted, "l:stream?" reports them. Only whole blocks are dropped: a block that has
+ * started going out is finished first, so the host keeps its place in the stream.
+ */
+
+#include "tusb.h"
+#include "stream.h"
+#include "vendor_stream.h"
+
+static uint8_t const *block;
+static size_t block_ix;
+
+void vendor_stream_task(void)
+{
+  if(!stream_running() || !tud_vendor_mounted())
+  {
+    block = NULL;
+    return;
+  }
+
+  for(;;)
+  {
+    // a block part way out is not claimed again, the ring may have skipped past it
+    if(!block)
+    {
+      block = stream_claim_block();
+      block_ix = 0;
+    }
+    if(!block)
+      break;
+
+    uint32_t len = tu_min32(tud_vendor_write_available(), STREAM_BLOCK_BYTES - block_ix);
+    if(len == 0)
+      break;
+
+    tud_vendor_write(block + block_ix, len);
+    block_ix += len;
+    if(block_ix == STREAM_BLOCK_BYTES)
+    {
+      stream_release_block();
+      block = NULL;
+    }
+  }
+  tud_vendor_write_flush();
+}
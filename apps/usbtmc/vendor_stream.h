@@ -0,0 +1,6 @@
+#ifndef VENDOR_STREAM_H
+#define VENDOR_STREAM_H
+
+void vendor_stream_task(void);
+
+#endif
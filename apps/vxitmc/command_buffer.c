@@ -0,0 +1,127 @@
+#include <string.h>
+
+#include "command_buffer.h"
+#include "commands.h"
+
+// no SDK headers, so the command buffer also builds for the host tests in test/
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+void command_buffer_reset(COMMAND_BUFFER_T *cb)
+{
+    cb->line_len = 0;
+    cb->discard = false;
+    cb->upload_buf = NULL;
+    cb->upload_len = 0;
+    cb->upload_ix = 0;
+    cb->block_start = 0;
+    cb->upload_skip = false;
+    cb->lost = false;
+}
+
+/*******************************************************************************************
+ * Add a byte of command text. A command too long for the line, or with a bad block
+ * header, is marked to be discarded. A block longer than the upload buffer, or any block
+ * when the buffer is read only, is skipped. One without a length to skip by leaves the
+ * buffer lost.
+ * *****************************************************************************************/
+void command_buffer_put(COMMAND_BUFFER_T *cb, uint8_t c)
+{
+    if(cb->discard)
+        return;
+    if(cb->line_len + 1 >= sizeof(cb->line))
+    {
+        cb->discard = true;
+        return;
+    }
+    cb->line[cb->line_len++] = c;
+
+    size_t block_start = cb->block_start;
+    if(c == '#' && !block_start && upload_target(cb->line, cb->line_len, &cb->upload_max))
+    {
+        cb->block_start = cb->line_len - 1;
+    }
+    else if(block_start && cb->line_len == block_start + 2)
+    {
+        if(c < '1' || c > '9')
+        {
+            // indefinite length blocks are not supported
+            cb->discard = true;
+            cb->lost = true;
+        }
+    }
+    else if(block_start && cb->line_len == block_start + 2 + (cb->line[block_start + 1] - '0'))
+    {
+        cb->upload_len = 0;
+        for(size_t i = block_start + 2; i < cb->line_len; i++)
+        {
+            if(cb->line[i] < '0' || cb->line[i] > '9')
+            {
+                cb->discard = true;
+                cb->lost = true;
+            }
+            cb->upload_len = cb->upload_len * 10 + (cb->line[i] - '0');
+        }
+        cb->upload_ix = 0;
+        if(cb->lost)
+            cb->upload_len = 0;
+        else if(cb->upload_len > cb->upload_max || cb->read_only)
+        {
+            cb->discard = true;
+            cb->upload_skip = true;
+        }
+        else
+            cb->upload_buf = upload_target(cb->line, cb->line_len, &cb->upload_max);
+    }
+}
+
+/*******************************************************************************************
+ * Copy block data to the upload buffer, or drop it for a refused block. Returns the bytes
+ * taken.
+ * *****************************************************************************************/
+size_t command_buffer_upload(COMMAND_BUFFER_T *cb, uint8_t const *data, size_t len)
+{
+    size_t n = MIN(len, cb->upload_len - cb->upload_ix);
+    if(cb->upload_buf)
+        memcpy(&cb->upload_buf[cb->upload_ix], data, n);
+    cb->upload_ix += n;
+    return n;
+}
+
+bool command_buffer_uploading(COMMAND_BUFFER_T *cb)
+{
+    return (cb->upload_buf || cb->upload_skip) && cb->upload_ix < cb->upload_len;
+}
+
+bool command_buffer_block_done(COMMAND_BUFFER_T *cb)
+{
+    return (cb->upload_buf || cb->upload_skip) && cb->upload_ix == cb->upload_len;
+}
+
+/*******************************************************************************************
+ * A block was refused before its length could be read. There is no telling where it
+ * ends, so a transport without its own framing has to drop the connection.
+ * *****************************************************************************************/
+bool command_buffer_lost(COMMAND_BUFFER_T *cb)
+{
+    return cb->lost;
+}
+
+/*******************************************************************************************
+ * The command is complete. Trailing line ends are dropped and the text NUL terminated.
+ * Returns its length, 0 if there is nothing to run.
+ * *****************************************************************************************/
+size_t command_buffer_end(COMMAND_BUFFER_T *cb)
+{
+    size_t len = cb->line_len;
+    if(cb->discard)
+        return 0;
+    if(!cb->upload_buf)
+    {
+        while(len && (cb->line[len-1] == '\r' || cb->line[len-1] == '\n' || cb->line[len-1] == ' '))
+            len--;
+    }
+    cb->line[len] = 0;  // there is always room for the terminator
+    return len;
+}
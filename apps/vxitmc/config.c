@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pico/stdlib.h>
+
+#include "lwip/tcp.h"
+
+#include "config.h"
+#include "wifi.h"
+#include "commands.h"
+#include "log.h"
+#ifdef ENABLE_EEPROM
+#include "eeprom_24lc02b.h"
+#endif
+
+#define CONFIG_ENTRIES_MAX (CONFIG_IMAGE_SIZE - sizeof(CONFIG_HEADER_T))
+
+// the store as it is in RAM, and the EEPROM as it holds it or will once the queue is written
+static uint8_t store[CONFIG_IMAGE_SIZE];
+static uint8_t chip[CONFIG_EEPROM_SIZE];
+static CONFIG_HEADER_T *const header = (CONFIG_HEADER_T *)store;
+static uint8_t *const entries = store + sizeof(CONFIG_HEADER_T);
+
+#ifdef ENABLE_EEPROM
+_Static_assert(sizeof(CONFIG_HEADER_T) <= EEPROM_PAGE_SIZE, "the header is committed as one page");
+_Static_assert(CONFIG_AREA_SIZE % EEPROM_PAGE_SIZE == 0, "pages do not cross an area");
+#endif
+
+uint16_t config_crc16(uint8_t const *data, size_t len)
+{
+    uint16_t crc = 0xffff;
+    while(len--)
+    {
+        crc ^= (uint16_t)*data++ << 8;
+        for(int i=0; i<8; i++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+/*******************************************************************************************
+ * Where offset in the store is in the EEPROM
+ * *****************************************************************************************/
+static uint8_t chip_address(uint offset)
+{
+    return CONFIG_AREA(offset / CONFIG_AREA_SIZE) + offset % CONFIG_AREA_SIZE;
+}
+
+static void reset_store(void)
+{
+    memset(store, 0, sizeof(store));
+    header->magic = CONFIG_MAGIC;
+    header->version = CONFIG_VERSION;
+}
+
+/*******************************************************************************************
+ * The entry for key, or NULL. Entries are walked with their lengths checked against the
+ * end of the store, as a damaged length could otherwise run off it.
+ * *****************************************************************************************/
+static uint8_t *find(uint8_t key)
+{
+    uint8_t *p = entries;
+    uint8_t *end = entries + header->length;
+    while(p + 2 <= end && p[0] != CONFIG_END && p + 2 + p[1] <= end)
+    {
+        if(p[0] == key)
+            return p;
+        p += 2 + p[1];
+    }
+    return NULL;
+}
+
+static bool append(uint8_t key, void const *value, int len)
+{
+    if(len > 255 || header->length + 2 + len > CONFIG_ENTRIES_MAX)
+        return false;
+    uint8_t *p = entries + header->length;
+    p[0] = key;
+    p[1] = len;
+    memcpy(p + 2, value, len);
+    header->length += 2 + len;
+    return true;
+}
+
+static bool valid_store(void)
+{
+    return header->magic == CONFIG_MAGIC && header->version == CONFIG_VERSION &&
+           header->length <= CONFIG_ENTRIES_MAX && header->crc == config_crc16(entries, header->length);
+}
+
+/*******************************************************************************************
+ * An EEPROM written before the store existed may hold the WiFi cache where the store now
+ * starts. It is taken into the store, which replaces it the first time anything is saved.
+ * *****************************************************************************************/
+static void load_legacy(void)
+{
+    reset_store();
+    WIFI_CACHE_T cache;
+    memcpy(&cache, chip + WIFI_CACHE_ADDRESS, sizeof(cache));
+    if(cache.magic == WIFI_CACHE_MAGIC)
+        append(CONFIG_WIFI, &cache, sizeof(cache));
+}
+
+/*******************************************************************************************
+ * Read the whole EEPROM in one transfer. Returns false if it could not be read.
+ * *****************************************************************************************/
+bool config_load(void)
+{
+#ifdef ENABLE_EEPROM
+    if(eeprom_read(0, chip, sizeof(chip)) != sizeof(chip))
+    {
+        reset_store();
+        memset(chip, CONFIG_ERASED, sizeof(chip));
+        return false;
+    }
+    for(uint offset=0; offset<CONFIG_IMAGE_SIZE; offset+=CONFIG_AREA_SIZE)
+        memcpy(store + offset, chip + chip_address(offset), CONFIG_AREA_SIZE);
+    if(header->magic != CONFIG_MAGIC)
+    {
+        printf("No config store\n");
+        load_legacy();
+    }
+    else if(!valid_store())
+    {
+        // a save was cut short, the bytes are the store's and not a legacy cache
+        printf("Config store damaged, using the defaults\n");
+        reset_store();
+    }
+    return true;
+#else
+    reset_store();
+    memset(chip, CONFIG_ERASED, sizeof(chip));
+    return false;
+#endif
+}
+
+/*******************************************************************************************
+ * A credential from its fixed field. Returns its length, or -1 if there is none or it
+ * does not fit.
+ * *****************************************************************************************/
+static int get_credential(uint address, void *value, int max_len)
+{
+    char const *raw = (char const *)chip + address;
+    if((uint8_t)raw[0] == CONFIG_ERASED)
+        return -1;
+    int len = strnlen(raw, CONFIG_CREDENTIAL_MAX);
+    if(len > max_len)
+        return -1;
+    memcpy(value, raw, len);
+    return len;
+}
+
+/*******************************************************************************************
+ * Copy the value of key to value. Returns its length, or -1 if there is none or it does
+ * not fit.
+ * *****************************************************************************************/
+int config_get(uint8_t key, void *value, int max_len)
+{
+    if(key == CONFIG_SSID)
+        return get_credential(CONFIG_LEGACY_SSID, value, max_len);
+    if(key == CONFIG_PWD)
+        return get_credential(CONFIG_LEGACY_PWD, value, max_len);
+
+    uint8_t *p = find(key);
+    if(!p || p[1] > max_len)
+        return -1;
+    memcpy(value, p + 2, p[1]);
+    return p[1];
+}
+
+bool config_get_string(uint8_t key, char *value, int size)
+{
+    int len = config_get(key, value, size - 1);
+    if(len < 0)
+        return false;
+    value[len] = 0;
+    return true;
+}
+
+/*******************************************************************************************
+ * Replace the value of key and queue the pages of the EEPROM that changed. The caller
+ * does not wait for the EEPROM, eeprom_task() writes the pages in the background, the
+ * header last.
+ * *****************************************************************************************/
+bool config_set(uint8_t key, void const *value, int len)
+{
+    if(key == CONFIG_SSID || key == CONFIG_PWD)
+        return false;
+
+    uint8_t *p = find(key);
+    uint8_t old_length = header->length;
+    if(len > 255 || header->length - (p ? 2 + p[1] : 0) + 2 + len > CONFIG_ENTRIES_MAX)
+    {
+        LOG_WARN(LOG_CONFIG_FULL, key);
+        return false;
+    }
+    if(p)
+    {
+        // drop the old entry by moving the ones behind it down
+        uint entry_len = 2 + p[1];
+        memmove(p, p + entry_len, entries + header->length - (p + entry_len));
+        header->length -= entry_len;
+    }
+    append(key, value, len);
+    memset(entries + header->length, CONFIG_END, MAX(old_length, header->length) - header->length);
+    header->crc = config_crc16(entries, header->length);
+
+#ifdef ENABLE_EEPROM
+    for(uint page=0; page<CONFIG_IMAGE_SIZE; page+=EEPROM_PAGE_SIZE)
+    {
+        uint8_t *on_chip = chip + chip_address(page);
+        if(!memcmp(store + page, on_chip, EEPROM_PAGE_SIZE))
+            continue;
+        if(page == 0)
+            eeprom_write_async_last(chip_address(page), store + page, EEPROM_PAGE_SIZE);
+        else
+            eeprom_write_async(chip_address(page), store + page, EEPROM_PAGE_SIZE);
+        memcpy(on_chip, store + page, EEPROM_PAGE_SIZE);
+    }
+#endif
+    return true;
+}
+
+/*******************************************************************************************
+ * Preset 0 is the power on setting of the selected analyser
+ * *****************************************************************************************/
+void config_apply_presets(void)
+{
+    CONFIG_PRESET_T preset;
+    if(config_get(CONFIG_PRESET, &preset, sizeof(preset)) == sizeof(preset))
+        set_capture_params(preset.sample_rate, preset.trig_channel, preset.trig_type);
+}
+
+/*******************************************************************************************
+ * *sav <n> - keep the rate and trigger of the selected analyser as preset n
+ * *rcl <n> - set them from preset n
+ * Presets 0 to CONFIG_PRESETS-1 are kept in the EEPROM. Returns false if the command is
+ * not one of these.
+ * *****************************************************************************************/
+bool config_command(LINK_T *link, uint8_t const *data, size_t len)
+{
+    bool save = len >= 5 && !strncasecmp("*sav ", (char const*)data, 5);
+    bool recall = len >= 5 && !strncasecmp("*rcl ", (char const*)data, 5);
+    if(!save && !recall)
+        return false;
+
+    int n = atoi((char const*)data + 5);
+    CONFIG_PRESET_T preset;
+    if(n < 0 || n >= CONFIG_PRESETS)
+    {
+        LOG_WARN(LOG_CONFIG_PRESET, n);
+        return true;
+    }
+
+    if(save)
+    {
+        float rate;
+        uint32_t trig_channel, trig_type;
+        get_capture_params(&rate, &trig_channel, &trig_type);
+        memset(&preset, 0, sizeof(preset));
+        preset.sample_rate = rate;
+        preset.trig_channel = trig_channel;
+        preset.trig_type = trig_type;
+        config_set(CONFIG_PRESET + n, &preset, sizeof(preset));
+    }
+    else if(config_get(CONFIG_PRESET + n, &preset, sizeof(preset)) == sizeof(preset))
+        set_capture_params(preset.sample_rate, preset.trig_channel, preset.trig_type);
+    else
+        LOG_WARN(LOG_CONFIG_PRESET, n);
+    return true;
+}
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <string.h>
+#include <pico/stdlib.h>
+
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+#include "lwip/netif.h"
+#include "lwip/apps/mdns.h"
+
+#include "discovery.h"
+#include "vxi_core_prog.h"
+#include "scpi_server.h"
+#include "hislip_server.h"
+#include "log.h"
+
+// a UDP call fits in this, VISA discovery sends AUTH_NULL or a short AUTH_UNIX credential
+#define PORTMAP_CALL_WORDS 64
+
+static struct udp_pcb *portmap_pcb;
+static char mdns_name[MDNS_NAME_MAX];
+
+/*******************************************************************************************
+ * The port a program is served on, 0 if it is not. Only the portmapper answers on UDP.
+ * *****************************************************************************************/
+static uint16_t program_port(uint32_t program, bool tcp)
+{
+    if(program == PORTMAP_PROGRAM)
+        return TCP_PORT;
+    if(!tcp)
+        return 0;
+    if(program == VXI_CORE_PROGRAM)
+        return TCP_PORT;
+    if(program == VXI_ASYNC_PROGRAM)
+        return VXI_ABORT_PORT;
+    return 0;
+}
+
+/*******************************************************************************************
+ * Answer PMAPPROC_GETPORT (version 2) and rpcbind GETADDR (versions 3 and 4) with the
+ * address of the interface we are on. rpc_call is laid out as on TCP, behind a record
+ * marker. Returns false if the call is not one of these.
+ * *****************************************************************************************/
+bool portmap_reply(TCP_RPC_T *rpc_call, uint32_t len, RPC_REPLY_T *reply)
+{
+    uint args_words;
+    uint32_t *args = rpc_call_args(rpc_call, len, &args_words);
+    uint version = htonl(rpc_call->version);
+
+    if(htonl(rpc_call->procedure) != PORTMAP_GETPORT || !args || args_words < 3)
+        return false;
+
+    uint32_t program = htonl(args[0]);
+    rpc_reply_start(reply, rpc_call->xid);
+    if(version == 2)
+    {
+        // mapping: prog, vers, prot, port
+        LOG_DEBUG(LOG_PORTMAP_GETPORT, program);
+        rpc_reply_put_u32(reply, program_port(program, htonl(args[2]) == PORTMAP_PROTO_TCP));
+        return true;
+    }
+    if(version == 3 || version == 4)
+    {
+        // rpcb: prog, vers, netid, addr, owner. The reply is a universal address,
+        // h1.h2.h3.h4.p1.p2, or an empty string for a program that is not served.
+        uint netid_len = htonl(args[2]);
+        bool tcp = netid_len == 3 && args_words > 3 && !memcmp(&args[3], "tcp", 3);
+        uint16_t port = program_port(program, tcp);
+        char address[24];
+        int address_len = 0;
+
+        LOG_DEBUG(LOG_PORTMAP_GETADDR, program);
+        if(port && netif_default)
+        {
+            const ip4_addr_t *ip = netif_ip4_addr(netif_default);
+            address_len = snprintf(address, sizeof(address), "%u.%u.%u.%u.%u.%u",
+                                   ip4_addr1(ip), ip4_addr2(ip), ip4_addr3(ip), ip4_addr4(ip),
+                                   port >> 8, port & 0xff);
+        }
+        rpc_reply_put_string(reply, address, address_len);
+        return true;
+    }
+    return false;
+}
+
+/*******************************************************************************************
+ * VISA finds instruments by broadcasting portmapper calls over UDP. The call is copied
+ * behind a record marker word, so it has the layout portmap_reply() expects, and the
+ * reply goes back without one.
+ * *****************************************************************************************/
+static void portmap_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    static uint32_t call[PORTMAP_CALL_WORDS];
+    RPC_REPLY_T reply;
+
+    uint32_t len = pbuf_copy_partial(p, call + 1, sizeof(call) - 4, 0) + 4;
+    pbuf_free(p);
+
+    TCP_RPC_T *rpc_call = (TCP_RPC_T*)call;
+    if(len < sizeof(TCP_RPC_T) - sizeof(void*) || htonl(rpc_call->msg_type) != 0 ||
+       htonl(rpc_call->program) != PORTMAP_PROGRAM)
+        return;
+    if(!portmap_reply(rpc_call, len, &reply))
+        return;
+
+    struct pbuf *out = pbuf_alloc(PBUF_TRANSPORT, reply.len - 4, PBUF_RAM);
+    if(!out)
+        return;
+    pbuf_take(out, reply.data + 4, reply.len - 4);
+    udp_sendto(pcb, out, addr, port);
+    pbuf_free(out);
+}
+
+static void mdns_txt(struct mdns_service *service, void *txt_userdata)
+{
+    mdns_resp_add_service_txtitem(service, "txtvers=1", 9);
+}
+
+/*******************************************************************************************
+ * UDP portmapper and mDNS records for the VXI-11, raw socket and HiSLIP servers. Each
+ * unit is named after the end of its MAC address, so a rack of them can be told apart.
+ * Neither is needed to connect by address, so failures are only logged.
+ * *****************************************************************************************/
+void discovery_start(void)
+{
+    portmap_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    if(!portmap_pcb)
+        LOG_ERROR(LOG_PCB_FAILED);
+    else if(udp_bind(portmap_pcb, IP_ANY_TYPE, TCP_PORT) != ERR_OK)
+        LOG_ERROR(LOG_BIND_FAILED, TCP_PORT);
+    else
+        udp_recv(portmap_pcb, portmap_recv, NULL);
+
+    struct netif *netif = netif_default;
+    if(!netif)
+        return;
+    snprintf(mdns_name, sizeof(mdns_name), "pico-logic-%02x%02x%02x",
+             netif->hwaddr[3], netif->hwaddr[4], netif->hwaddr[5]);
+    printf("mDNS name %s.local\n", mdns_name);
+
+    mdns_resp_init();
+    err_t err = mdns_resp_add_netif(netif, mdns_name);
+    if(err != ERR_OK)
+    {
+        LOG_ERROR(LOG_MDNS_FAILED, err);
+        return;
+    }
+    if(mdns_resp_add_service(netif, mdns_name, "_vxi-11", DNSSD_PROTO_TCP, TCP_PORT, mdns_txt, NULL) < 0 ||
+       mdns_resp_add_service(netif, mdns_name, "_scpi-raw", DNSSD_PROTO_TCP, SCPI_PORT, mdns_txt, NULL) < 0 ||
+       mdns_resp_add_service(netif, mdns_name, "_hislip", DNSSD_PROTO_TCP, HISLIP_PORT, mdns_txt, NULL) < 0)
+        LOG_ERROR(LOG_MDNS_FAILED, ERR_MEM);
+    mdns_resp_announce(netif);
+}
@@ -4,106 +4,127 @@
 #include "pico/stdlib.h"
 #include "hardware/i2c.h"
 
+#include "eeprom_24lc02b.h"
+
 /****************************************************
  * External EEPROM handler
  ***************************************************/
 #define EEPROM_I2C_ADDRESS 0X50
+#define EEPROM_I2C_BAUD (400 * 1000)
+#define EEPROM_WRITE_MS 10          // the part needs up to 5 ms per page
+#define EEPROM_POLL_US 200
 
-int eeprom_write(uint8_t address, uint8_t data)
-{
-    uint8_t buffer[2];
+_Static_assert(EEPROM_SIZE / EEPROM_PAGE_SIZE <= 32, "one dirty bit per page");
 
-    buffer[0] = address;
-    buffer[1] = data;
-    return i2c_write_blocking(i2c1, EEPROM_I2C_ADDRESS, buffer, 2, false);
-}
+// pages written with eeprom_write_async() that have yet to go to the part
+static uint8_t pending[EEPROM_SIZE];
+static uint32_t dirty_pages;
+static uint32_t last_pages;         // written once no other page is dirty
+static bool write_cycle;            // the part is busy with the last page written
 
-int eeprom_write_block_(uint8_t address, uint8_t *data, int length)
+/*******************************************************************************************
+ * While it writes a page the part does not acknowledge its address, so a one byte read
+ * that is acknowledged means the write has finished
+ * *****************************************************************************************/
+static bool eeprom_ready(void)
 {
-    uint8_t *buffer = malloc(1+length);
-
-    buffer[0] = address;
-    memcpy(buffer+1, data, length);
-    
-    int ret = i2c_write_blocking(i2c1, EEPROM_I2C_ADDRESS, buffer, 1+length, false);
-    free(buffer);
-    return ret;
+    uint8_t dummy;
+    return i2c_read_timeout_us(i2c1, EEPROM_I2C_ADDRESS, &dummy, 1, false, EEPROM_POLL_US) == 1;
 }
 
-int eeprom_write_block(uint8_t address, uint8_t *data, int length)
+static bool wait_ready(void)
 {
-    // only 8 bytes at a time
-    int ret = 0;
-    uint8_t eights = length / 8;
-    uint8_t left_over = length % 8;
-    for(int i=0;i<eights; i++)
-    {
-        uint8_t add = address + i*8;
-        uint8_t *data_ptr = data + (i*8);
-        int bytes_written = eeprom_write_block_(add, data_ptr, 8);
-        if(bytes_written >0)
-        {
-            ret += bytes_written;
-        }
-        else
-        {
-            printf("FAILED %d at %d\n", bytes_written, add);
-        }
-        // wait a bit. Is there a way to acknowledge a write ?
-        sleep_ms(5);
-    }
-    if(left_over > 0)
+    absolute_time_t until = make_timeout_time_ms(EEPROM_WRITE_MS);
+    while(!eeprom_ready())
     {
-        ret += eeprom_write_block_(address + left_over + eights*8, data+ (left_over + eights*8), left_over);
+        if(time_reached(until))
+            return false;
     }
-    return ret;
+    write_cycle = false;
+    return true;
 }
 
-int eeprom_read(uint8_t address, uint8_t *data)
+/*******************************************************************************************
+ * Write within one page, the part wraps at the page boundary
+ * *****************************************************************************************/
+static int write_page(uint8_t address, uint8_t const *data, int length)
 {
-    uint8_t buffer[1];
+    uint8_t buffer[1+EEPROM_PAGE_SIZE];
+
     buffer[0] = address;
-    int ret;
-    ret = i2c_write_blocking(i2c1, EEPROM_I2C_ADDRESS, buffer, 1, true);
-    if(ret == 1)
-        ret = i2c_read_blocking(i2c1, EEPROM_I2C_ADDRESS, data, 1, false);
+    memcpy(buffer+1, data, length);
+    int ret = i2c_write_blocking(i2c1, EEPROM_I2C_ADDRESS, buffer, 1+length, false);
+    if(ret > 0)
+        write_cycle = true;
+    return ret - 1;
+}
 
-    return ret;
+/*******************************************************************************************
+ * Queue length bytes to be written from eeprom_task(), so the caller does not wait for
+ * the write cycles. Later writes to the same bytes replace earlier ones.
+ * *****************************************************************************************/
+void eeprom_write_async(uint8_t address, uint8_t const *data, int length)
+{
+    length = MIN(length, EEPROM_SIZE - address);
+    memcpy(pending + address, data, length);
+    for(int page = address / EEPROM_PAGE_SIZE; page * EEPROM_PAGE_SIZE < address + length; page++)
+        dirty_pages |= 1u << page;
 }
 
-int eeprom_read_block(uint8_t address, uint8_t *data)
+/*******************************************************************************************
+ * Queue like eeprom_write_async(), to be written after every other queued page. A header
+ * queued this way only reaches the part once what it describes is there.
+ * *****************************************************************************************/
+void eeprom_write_async_last(uint8_t address, uint8_t const *data, int length)
 {
-    uint8_t *buffer = malloc(257);
-    buffer[0] = address;
-    int ret;
-    ret = eeprom_read(255, buffer);
-    ret = i2c_read_blocking(i2c1, EEPROM_I2C_ADDRESS, buffer+1, 256, false);
-    memcpy(data, buffer + 1, 256);
-    free(buffer);
-    return ret;
+    eeprom_write_async(address, data, length);
+    for(int page = address / EEPROM_PAGE_SIZE; page * EEPROM_PAGE_SIZE < address + length; page++)
+        last_pages |= 1u << page;
 }
 
-void dump_block(uint8_t* data)
+/*******************************************************************************************
+ * Write the next queued page once the part has finished the last one. Each call is one
+ * short I2C transfer at most.
+ * *****************************************************************************************/
+void eeprom_task(void)
 {
-    uint8_t ascii[9];
-    ascii[8] = 0;
+    if(write_cycle)
+    {
+        if(!eeprom_ready())
+            return;
+        write_cycle = false;
+    }
+    if(!dirty_pages)
+        return;
 
-    for(int i=0; i<32; i++)
+    uint32_t pages = dirty_pages & ~last_pages ? dirty_pages & ~last_pages : dirty_pages;
+    int page = __builtin_ctz(pages);
+    uint8_t address = page * EEPROM_PAGE_SIZE;
+    if(write_page(address, pending + address, EEPROM_PAGE_SIZE) == EEPROM_PAGE_SIZE)
     {
-        printf("0x%02x", i*8);
-        for(int j=0; j<8; j++)
-        {
-            uint loc = j+ i*8;
-            printf(" %02x", data[loc]);
-            ascii[j] = data[loc] >= 32 && data[loc] <= 127 ? data[loc] : '.';
-        }
-        printf(" %s\n", ascii);
+        dirty_pages &= ~(1u << page);
+        last_pages &= ~(1u << page);
     }
 }
 
+/*******************************************************************************************
+ * Sequential read of length bytes from address in one transfer. Returns the number of
+ * bytes read or a PICO_ERROR.
+ * *****************************************************************************************/
+int eeprom_read(uint8_t address, uint8_t *data, int length)
+{
+    if(write_cycle && !wait_ready())
+        return PICO_ERROR_TIMEOUT;
+
+    int ret = i2c_write_blocking(i2c1, EEPROM_I2C_ADDRESS, &address, 1, true);
+    if(ret == 1)
+        ret = i2c_read_blocking(i2c1, EEPROM_I2C_ADDRESS, data, length, false);
+    return ret;
+}
+
 int initialise_eeprom(uint data_pin, uint clock_pin)
 {
-    i2c_init(i2c1, 100 * 1000);
+    i2c_init(i2c1, EEPROM_I2C_BAUD);
     gpio_set_function(data_pin, GPIO_FUNC_I2C);
     gpio_set_function(clock_pin, GPIO_FUNC_I2C);
     gpio_pull_up(data_pin);
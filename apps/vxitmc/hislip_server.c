@@ -0,0 +1,662 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pico/stdlib.h>
+
+#include "pico/cyw43_arch.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+
+#include "rpc_server.h"
+#include "hislip_server.h"
+#include "netbench.h"
+#include "log.h"
+#include "commands.h"
+
+// overlapped mode: each response carries the message id of its query. They come back in
+// the order of the queries, which overlapped mode allows. Synchronized mode would need
+// the Interrupted handling for unread responses, which the server does not do.
+#define HISLIP_OVERLAPPED 1
+
+#define STB_MAV 0x10
+#define STB_RQS 0x40
+
+err_t hislip_accept(void *arg, struct tcp_pcb *client_pcb, err_t err);
+err_t hislip_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
+err_t hislip_sent(void *arg, struct tcp_pcb *tpcb, u16_t len);
+err_t hislip_poll(void *arg, struct tcp_pcb *tpcb);
+void hislip_err(void *arg, err_t err);
+
+static void hislip_process(HISLIP_CONN_T *conn);
+static void hislip_close(HISLIP_CONN_T *conn);
+
+static HISLIP_CONN_T connections[HISLIP_CONNECTIONS];
+static HISLIP_SESSION_T hislip_sessions[MAX_SESSIONS];
+static uint16_t next_session_id = 1;
+static uint32_t captures_seen;
+
+static uint32_t get_be32(uint8_t const *data)
+{
+    return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+static void put_be32(uint8_t *data, uint32_t value)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static void put_header(uint8_t *header, uint8_t type, uint8_t control, uint32_t parameter, uint64_t payload_len)
+{
+    header[0] = 'H';
+    header[1] = 'S';
+    header[2] = type;
+    header[3] = control;
+    put_be32(header + 4, parameter);
+    put_be32(header + 8, payload_len >> 32);
+    put_be32(header + 12, (uint32_t)payload_len);
+}
+
+bool hislip_server_open(void)
+{
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        LOG_ERROR(LOG_PCB_FAILED);
+        return false;
+    }
+
+    err_t err = tcp_bind(pcb, NULL, HISLIP_PORT);
+    if (err) {
+        LOG_ERROR(LOG_BIND_FAILED, HISLIP_PORT);
+        return false;
+    }
+
+    struct tcp_pcb *listen_pcb = tcp_listen_with_backlog(pcb, HISLIP_CONNECTIONS);
+    if (!listen_pcb) {
+        LOG_ERROR(LOG_LISTEN_FAILED);
+        tcp_close(pcb);
+        return false;
+    }
+
+    tcp_accept(listen_pcb, hislip_accept);
+    return true;
+}
+
+err_t hislip_accept(void *arg, struct tcp_pcb *client_pcb, err_t err)
+{
+    if (err != ERR_OK || client_pcb == NULL) {
+        LOG_ERROR(LOG_ACCEPT_FAILED, err);
+        return err;
+    }
+
+    HISLIP_CONN_T *conn = NULL;
+    for(int i=0; i<HISLIP_CONNECTIONS; i++)
+    {
+        if(!connections[i].in_use)
+        {
+            conn = &connections[i];
+            break;
+        }
+    }
+    if (!conn) {
+        LOG_WARN(LOG_SESSION_FULL);
+        tcp_abort(client_pcb);
+        return ERR_ABRT;
+    }
+
+    memset(conn, 0, sizeof(HISLIP_CONN_T));
+    conn->in_use = true;
+    conn->pcb = client_pcb;
+
+    tcp_nagle_disable(client_pcb);
+    tcp_arg(client_pcb, conn);
+    tcp_sent(client_pcb, hislip_sent);
+    tcp_recv(client_pcb, hislip_recv);
+    tcp_poll(client_pcb, hislip_poll, POLL_TIME_S * 2);
+    tcp_err(client_pcb, hislip_err);
+
+    return ERR_OK;
+}
+
+err_t hislip_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    HISLIP_CONN_T *conn = (HISLIP_CONN_T*)arg;
+    cyw43_arch_lwip_check();
+
+    if(p == NULL)
+    {
+        LOG_DEBUG(LOG_TCP_EOF);
+        hislip_close(conn);
+        return ERR_OK;
+    }
+
+    if(conn->rx)
+        pbuf_cat(conn->rx, p);
+    else
+        conn->rx = p;
+    hislip_process(conn);
+    return ERR_OK;
+}
+
+err_t hislip_sent(void *arg, struct tcp_pcb *tpcb, u16_t len)
+{
+    HISLIP_CONN_T *conn = (HISLIP_CONN_T*)arg;
+    LOG_DEBUG(LOG_TCP_SENT, len);
+    if(!conn)
+        return ERR_OK;
+
+    if(!conn->async && conn->hs)
+        netbench_sent(conn->hs->session);
+    if(!conn->async && conn->hs && conn->hs->session->tx_count)
+        send_queued(conn->hs->session);
+    // messages that arrived behind the response can run now
+    hislip_process(conn);
+    return ERR_OK;
+}
+
+err_t hislip_poll(void *arg, struct tcp_pcb *tpcb)
+{
+    HISLIP_CONN_T *conn = (HISLIP_CONN_T*)arg;
+    if(conn && !conn->async && conn->hs && conn->hs->session->tx_count)
+        return send_queued(conn->hs->session);
+    return ERR_OK;
+}
+
+void hislip_err(void *arg, err_t err)
+{
+    HISLIP_CONN_T *conn = (HISLIP_CONN_T*)arg;
+    LOG_WARN(LOG_TCP_ERR, err);
+    // lwIP has already freed the pcb
+    if(conn)
+    {
+        conn->pcb = NULL;
+        if(conn->hs && conn->hs->sync == conn)
+            conn->hs->session->pcb = NULL;
+        hislip_close(conn);
+    }
+}
+
+/*******************************************************************************************
+ * Close one connection. Its pcb is closed unless lwIP has already freed it.
+ * *****************************************************************************************/
+static void conn_close(HISLIP_CONN_T *conn)
+{
+    if(!conn->in_use)
+        return;
+    if(conn->rx)
+        pbuf_free(conn->rx);
+    conn->rx = NULL;
+    if(conn->pcb)
+    {
+        tcp_arg(conn->pcb, NULL);
+        tcp_sent(conn->pcb, NULL);
+        tcp_recv(conn->pcb, NULL);
+        tcp_poll(conn->pcb, NULL, POLL_TIME_S * 2);
+        tcp_err(conn->pcb, NULL);
+        tcp_close(conn->pcb);
+    }
+    conn->pcb = NULL;
+    conn->hs = NULL;
+    conn->in_use = false;
+}
+
+/*******************************************************************************************
+ * A session ends with either of its channels, the other one is closed with it
+ * *****************************************************************************************/
+static void hislip_close(HISLIP_CONN_T *conn)
+{
+    HISLIP_SESSION_T *hs = conn->hs;
+    if(hs)
+    {
+        LOG_INFO(LOG_HISLIP_CLOSED, hs->id);
+        if(hs->sync && hs->sync != conn)
+            conn_close(hs->sync);
+        if(hs->async && hs->async != conn)
+            conn_close(hs->async);
+        hs->session->tx_count = 0;
+        session_close(hs->session);
+        hs->in_use = false;
+    }
+    conn_close(conn);
+}
+
+/*******************************************************************************************
+ * Short messages on either channel, copied by lwIP. The synchronous channel only uses
+ * this while its reply queue is idle.
+ * *****************************************************************************************/
+static void send_message(HISLIP_CONN_T *conn, uint8_t type, uint8_t control, uint32_t parameter, void const *payload, uint payload_len)
+{
+    uint8_t header[HISLIP_HEADER_LEN];
+    SEND_T send_data[2];
+
+    if(!conn || !conn->pcb)
+        return;
+
+    put_header(header, type, control, parameter, payload_len);
+    send_data[0].ptr = header;
+    send_data[0].length = HISLIP_HEADER_LEN;
+    send_data[0].flags = TCP_WRITE_FLAG_COPY | (payload_len ? TCP_WRITE_FLAG_MORE : 0);
+    send_data[1].ptr = (void*)payload;
+    send_data[1].length = payload_len;
+    send_data[1].flags = TCP_WRITE_FLAG_COPY;
+    if(send_data_list(conn->pcb, send_data, payload_len ? 2 : 1) == ERR_OK)
+        tcp_output(conn->pcb);
+}
+
+static void send_error(HISLIP_CONN_T *conn, uint8_t code, const char *message)
+{
+    LOG_WARN(LOG_HISLIP_ERROR, code);
+    send_message(conn, HISLIP_ERROR, code, 0, message, strlen(message));
+}
+
+/*******************************************************************************************
+ * The response goes back as one DataEnd message with the id of the request. Short data is
+ * copied behind the header, longer data is sent from where it lies through the session's
+ * reply queue.
+ * *****************************************************************************************/
+static void send_response(HISLIP_SESSION_T *hs)
+{
+    LINK_T *link = hs->link;
+    SESSION_T *session = hs->session;
+    SEND_T send_data[2];
+    uint send_count = 1;
+
+    if(!link->response_ready)
+        return;
+    link->response_ready = false;
+
+    // the block header buffer is shared by every link, keep a copy until it has gone
+    uint header_len = MIN(link->response_header_len, SESSION_TX_HEADER - HISLIP_HEADER_LEN);
+    put_header(session->tx_header, HISLIP_DATA_END, 0, hs->message_id, header_len + link->response_len);
+    if(header_len)
+        memcpy(session->tx_header + HISLIP_HEADER_LEN, link->response_header, header_len);
+    send_data[0].ptr = session->tx_header;
+    send_data[0].length = HISLIP_HEADER_LEN + header_len;
+    send_data[0].flags = TCP_WRITE_FLAG_COPY;
+
+    // a short response goes in the same write as its header
+    if(link->response_len && link->response_len <= SESSION_TX_HEADER - send_data[0].length)
+    {
+        memcpy(session->tx_header + send_data[0].length, link->response, link->response_len);
+        send_data[0].length += link->response_len;
+    }
+    else if(link->response_len)
+    {
+        send_data[1].ptr = (void*)link->response;
+        send_data[1].length = link->response_len;
+        send_data[1].flags = capture_buffer_holds(link->response) ? 0 : TCP_WRITE_FLAG_COPY;
+        send_count++;
+    }
+    send_data_queued(session, send_data, send_count);
+}
+
+/*******************************************************************************************
+ * *SRE is kept by the transport, a non zero mask asks for a service request when a
+ * capture completes
+ * *****************************************************************************************/
+static bool service_request_command(HISLIP_SESSION_T *hs, uint8_t const *cmd, size_t len)
+{
+    static uint8_t sre_buf[8];
+
+    if(len < 4 || strncasecmp((const char*)cmd, "*sre", 4))
+        return false;
+    if(len > 4 && cmd[4] == '?')
+    {
+        sprintf((char*)sre_buf, "%u\r\n", hs->service_request_enable);
+        link_set_response(hs->link, NULL, 0, sre_buf, strlen((const char*)sre_buf));
+    }
+    else
+        hs->service_request_enable = atoi((const char*)cmd + 4);
+    return true;
+}
+
+static void execute(HISLIP_SESSION_T *hs)
+{
+    size_t len = command_buffer_end(&hs->command);
+
+    if(hs->command.discard)
+        send_error(hs->sync, HISLIP_ERROR_MESSAGE_TOO_LARGE, "command too long or bad block header");
+    else if(len && link_locked_out(hs->link))
+        send_error(hs->sync, HISLIP_ERROR_UNIDENTIFIED, "locked by another client");
+    else if(len && !service_request_command(hs, hs->command.line, len))
+        link_process_command(hs->link, hs->command.line, len);
+    command_buffer_reset(&hs->command);
+    send_response(hs);
+}
+
+/*******************************************************************************************
+ * Initialize on a new connection makes it the synchronous channel of a new session
+ * *****************************************************************************************/
+static void initialize(HISLIP_CONN_T *conn, uint32_t parameter)
+{
+    HISLIP_SESSION_T *hs = NULL;
+    for(int i=0; i<MAX_SESSIONS; i++)
+    {
+        if(!hislip_sessions[i].in_use)
+        {
+            hs = &hislip_sessions[i];
+            break;
+        }
+    }
+
+    SESSION_T *session = hs ? session_open(conn->pcb) : NULL;
+    LINK_T *link = session ? link_create(session, false) : NULL;
+    if(!link)
+    {
+        if(session)
+            session_close(session);
+        send_message(conn, HISLIP_FATAL_ERROR, HISLIP_FATAL_MAX_SESSIONS, 0, NULL, 0);
+        hislip_close(conn);
+        return;
+    }
+
+    memset(hs, 0, sizeof(HISLIP_SESSION_T));
+    hs->in_use = true;
+    hs->id = next_session_id++;
+    if(next_session_id == 0)
+        next_session_id = 1;
+    hs->session = session;
+    hs->link = link;
+    hs->sync = conn;
+    command_buffer_reset(&hs->command);
+    conn->hs = hs;
+    LOG_INFO(LOG_HISLIP_SESSION, hs->id, link->id, parameter >> 16);
+
+    SEND_T send_data[1];
+    put_header(session->tx_header, HISLIP_INITIALIZE_RESPONSE, HISLIP_OVERLAPPED, (HISLIP_VERSION << 16) | hs->id, 0);
+    send_data[0].ptr = session->tx_header;
+    send_data[0].length = HISLIP_HEADER_LEN;
+    send_data[0].flags = TCP_WRITE_FLAG_COPY;
+    send_data_queued(session, send_data, 1);
+}
+
+/*******************************************************************************************
+ * AsyncInitialize on a new connection makes it the asynchronous channel of a session
+ * *****************************************************************************************/
+static void async_initialize(HISLIP_CONN_T *conn, uint32_t session_id)
+{
+    for(int i=0; i<MAX_SESSIONS; i++)
+    {
+        HISLIP_SESSION_T *hs = &hislip_sessions[i];
+        if(hs->in_use && hs->id == session_id && !hs->async)
+        {
+            hs->async = conn;
+            conn->hs = hs;
+            conn->async = true;
+            send_message(conn, HISLIP_ASYNC_INITIALIZE_RESPONSE, 0, HISLIP_VENDOR_ID, NULL, 0);
+            return;
+        }
+    }
+    send_message(conn, HISLIP_FATAL_ERROR, HISLIP_FATAL_INVALID_INIT, 0, NULL, 0);
+    hislip_close(conn);
+}
+
+/*******************************************************************************************
+ * Device clear: drop the command being received and any response not sent yet, stop a
+ * capture this client armed. Commands are refused until DeviceClearComplete.
+ * *****************************************************************************************/
+static void device_clear(HISLIP_SESSION_T *hs)
+{
+    LOG_INFO(LOG_HISLIP_CLEAR, hs->id);
+    hs->clearing = true;
+    command_buffer_reset(&hs->command);
+    command_sender_stop(hs->link);
+    link_cancel_response(hs->link);
+}
+
+static void async_lock(HISLIP_SESSION_T *hs, HISLIP_CONN_T *conn, uint8_t control, uint32_t timeout)
+{
+    if(control == 0)
+    {
+        // release
+        send_message(conn, HISLIP_ASYNC_LOCK_RESPONSE, link_unlock(hs->link) ? 1 : 3, 0, NULL, 0);
+    }
+    else if(link_lock(hs->link))
+    {
+        send_message(conn, HISLIP_ASYNC_LOCK_RESPONSE, 1, 0, NULL, 0);
+    }
+    else if(timeout > 0)
+    {
+        // shared locks are not supported, a lock name in the payload is ignored
+        LOG_DEBUG(LOG_HISLIP_LOCK_WAIT, hs->id, timeout);
+        hs->lock_pending = true;
+        hs->lock_deadline = make_timeout_time_ms(timeout);
+    }
+    else
+    {
+        send_message(conn, HISLIP_ASYNC_LOCK_RESPONSE, 0, 0, NULL, 0);
+    }
+}
+
+/*******************************************************************************************
+ * A whole message has arrived. Data and DataEnd payloads have already gone to the
+ * command buffer, other payloads are in conn->payload.
+ * *****************************************************************************************/
+static void dispatch(HISLIP_CONN_T *conn)
+{
+    HISLIP_SESSION_T *hs = conn->hs;
+    uint8_t type = conn->header[2];
+    uint8_t control = conn->header[3];
+    uint32_t parameter = get_be32(conn->header + 4);
+    LOG_DEBUG(LOG_HISLIP_MESSAGE, type, control, parameter);
+
+    if(!hs)
+    {
+        if(type == HISLIP_INITIALIZE)
+            initialize(conn, parameter);
+        else if(type == HISLIP_ASYNC_INITIALIZE)
+            async_initialize(conn, parameter);
+        else
+        {
+            send_message(conn, HISLIP_FATAL_ERROR, HISLIP_FATAL_NOT_INITIALIZED, 0, NULL, 0);
+            hislip_close(conn);
+        }
+        return;
+    }
+
+    if(!conn->async)
+    {
+        switch(type)
+        {
+        case HISLIP_DATA:
+            break;
+        case HISLIP_DATA_END:
+            hs->message_id = parameter;
+            if(hs->clearing)
+                command_buffer_reset(&hs->command);
+            else
+                execute(hs);
+            break;
+        case HISLIP_DEVICE_CLEAR_COMPLETE:
+            hs->clearing = false;
+            command_buffer_reset(&hs->command);
+            send_message(conn, HISLIP_DEVICE_CLEAR_ACKNOWLEDGE, HISLIP_OVERLAPPED, 0, NULL, 0);
+            break;
+        case HISLIP_TRIGGER:
+            break;
+        default:
+            send_error(conn, HISLIP_ERROR_UNKNOWN_MESSAGE, "unrecognized message type");
+            break;
+        }
+        return;
+    }
+
+    switch(type)
+    {
+    case HISLIP_ASYNC_MAX_MSG_SIZE:
+    {
+        uint8_t size[8];
+        put_be32(size, 0);
+        put_be32(size + 4, COMMAND_LINE_MAX + PATTERN_MAX_WORDS * 4);
+        send_message(conn, HISLIP_ASYNC_MAX_MSG_SIZE_RESPONSE, 0, 0, size, sizeof(size));
+        break;
+    }
+    case HISLIP_ASYNC_LOCK:
+        async_lock(hs, conn, control, parameter);
+        break;
+    case HISLIP_ASYNC_LOCK_INFO:
+    {
+        bool locked = link_lock_owner() != NULL;
+        send_message(conn, HISLIP_ASYNC_LOCK_INFO_RESPONSE, locked, locked, NULL, 0);
+        break;
+    }
+    case HISLIP_ASYNC_REMOTE_LOCAL_CONTROL:
+        send_message(conn, HISLIP_ASYNC_REMOTE_LOCAL_RESPONSE, 0, 0, NULL, 0);
+        break;
+    case HISLIP_ASYNC_DEVICE_CLEAR:
+        device_clear(hs);
+        send_message(conn, HISLIP_ASYNC_DEVICE_CLEAR_ACK, HISLIP_OVERLAPPED, 0, NULL, 0);
+        break;
+    case HISLIP_ASYNC_STATUS_QUERY:
+    {
+        uint8_t status = hs->link->response_ready || hs->session->tx_count ? STB_MAV : 0;
+        send_message(conn, HISLIP_ASYNC_STATUS_RESPONSE, status, 0, NULL, 0);
+        break;
+    }
+    default:
+        send_error(conn, HISLIP_ERROR_UNKNOWN_MESSAGE, "unrecognized message type");
+        break;
+    }
+}
+
+/*******************************************************************************************
+ * The synchronous channel takes no new message while a response is going out or a query
+ * waits for its capture, so responses come back in order
+ * *****************************************************************************************/
+static bool busy(HISLIP_CONN_T *conn)
+{
+    HISLIP_SESSION_T *hs = conn->hs;
+    return !conn->async && hs && (hs->session->tx_count || link_response_pending(hs->link));
+}
+
+/*******************************************************************************************
+ * Feed received bytes to the message parser, returns the bytes used
+ * *****************************************************************************************/
+static size_t feed(HISLIP_CONN_T *conn, uint8_t const *data, size_t len)
+{
+    size_t used = 0;
+
+    while(used < len && conn->in_use)
+    {
+        if(conn->header_len < HISLIP_HEADER_LEN)
+        {
+            if(conn->header_len == 0 && busy(conn))
+                break;
+
+            size_t n = MIN(len - used, HISLIP_HEADER_LEN - conn->header_len);
+            memcpy(conn->header + conn->header_len, data + used, n);
+            conn->header_len += n;
+            used += n;
+            if(conn->header_len < HISLIP_HEADER_LEN)
+                break;
+
+            if(conn->header[0] != 'H' || conn->header[1] != 'S')
+            {
+                send_message(conn, HISLIP_FATAL_ERROR, HISLIP_FATAL_BAD_HEADER, 0, NULL, 0);
+                hislip_close(conn);
+                break;
+            }
+            conn->payload_left = ((uint64_t)get_be32(conn->header + 8) << 32) | get_be32(conn->header + 12);
+            conn->payload_len = 0;
+        }
+        else
+        {
+            uint8_t type = conn->header[2];
+            size_t n = MIN(len - used, conn->payload_left);
+            if(!conn->async && conn->hs && (type == HISLIP_DATA || type == HISLIP_DATA_END))
+            {
+                COMMAND_BUFFER_T *cb = &conn->hs->command;
+                size_t sunk = netbench_sink(conn->hs->link, n);
+                if(sunk)
+                    n = sunk;
+                else if(command_buffer_uploading(cb))
+                    n = command_buffer_upload(cb, data + used, n);
+                else
+                {
+                    n = 1;
+                    command_buffer_put(cb, data[used]);
+                }
+            }
+            else
+            {
+                // other payloads are short, anything past the buffer is dropped
+                size_t keep = MIN(n, sizeof(conn->payload) - conn->payload_len);
+                memcpy(conn->payload + conn->payload_len, data + used, keep);
+                conn->payload_len += keep;
+            }
+            used += n;
+            conn->payload_left -= n;
+        }
+
+        if(conn->payload_left == 0)
+        {
+            conn->header_len = 0;
+            dispatch(conn);
+        }
+    }
+    return used;
+}
+
+/*******************************************************************************************
+ * Work through the received data. The receive window is only opened for what has been
+ * used, so a client that pipelines faster than its commands run is held back by TCP.
+ * *****************************************************************************************/
+static void hislip_process(HISLIP_CONN_T *conn)
+{
+    while(conn->in_use && conn->rx)
+    {
+        struct pbuf *p = conn->rx;
+        struct tcp_pcb *pcb = conn->pcb;
+        size_t used = feed(conn, p->payload, p->len);
+        if(!conn->in_use)
+            break;  // closed, the data has gone with it
+        if(used == 0)
+            break;
+        conn->rx = pbuf_free_header(p, used);
+        tcp_recved(pcb, used);
+    }
+}
+
+/*******************************************************************************************
+ * Complete lock waits, answer queries that waited for a capture and raise service
+ * requests when a capture completes
+ * *****************************************************************************************/
+void hislip_task(void)
+{
+    uint32_t captures = capture_count();
+    bool completed = captures != captures_seen;
+    captures_seen = captures;
+
+    for(int i=0; i<MAX_SESSIONS; i++)
+    {
+        HISLIP_SESSION_T *hs = &hislip_sessions[i];
+        if(!hs->in_use)
+            continue;
+
+        if(hs->lock_pending)
+        {
+            if(link_lock(hs->link))
+            {
+                hs->lock_pending = false;
+                send_message(hs->async, HISLIP_ASYNC_LOCK_RESPONSE, 1, 0, NULL, 0);
+            }
+            else if(time_reached(hs->lock_deadline))
+            {
+                hs->lock_pending = false;
+                send_message(hs->async, HISLIP_ASYNC_LOCK_RESPONSE, 0, 0, NULL, 0);
+            }
+        }
+
+        if(hs->link->response_ready && !hs->session->tx_count)
+        {
+            send_response(hs);
+            hislip_process(hs->sync);
+        }
+
+        if(completed && hs->service_request_enable)
+            send_message(hs->async, HISLIP_ASYNC_SERVICE_REQUEST, STB_RQS, 0, NULL, 0);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef __COMMAND_BUFFER_H__
+#define __COMMAND_BUFFER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define COMMAND_LINE_MAX 256
+
+/*******************************************************************************************
+ * Collects one command as it arrives from a stream transport. A "#<n><length>" block in
+ * an upload command (see upload_target()) is written straight to its upload buffer, so
+ * it may hold any bytes and only the text up to the block header is kept. A block that
+ * is refused is still read to its declared length and dropped, newlines in it do not end
+ * the command.
+ * *****************************************************************************************/
+typedef struct COMMAND_BUFFER_T_ {
+    uint8_t line[COMMAND_LINE_MAX];
+    size_t line_len;
+    bool discard;
+
+    uint8_t *upload_buf;
+    size_t upload_max;
+    size_t upload_len;
+    size_t upload_ix;
+    size_t block_start;
+    bool upload_skip;       // the block was refused, its bytes are dropped
+    bool lost;              // a refused block of unknown length, the rest of the stream is unreadable
+    bool read_only;         // blocks are refused, set by the transport and kept over resets
+} COMMAND_BUFFER_T;
+
+void command_buffer_reset(COMMAND_BUFFER_T *cb);
+void command_buffer_put(COMMAND_BUFFER_T *cb, uint8_t c);
+size_t command_buffer_upload(COMMAND_BUFFER_T *cb, uint8_t const *data, size_t len);
+bool command_buffer_uploading(COMMAND_BUFFER_T *cb);
+bool command_buffer_block_done(COMMAND_BUFFER_T *cb);
+bool command_buffer_lost(COMMAND_BUFFER_T *cb);
+size_t command_buffer_end(COMMAND_BUFFER_T *cb);
+
+#endif
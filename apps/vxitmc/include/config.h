@@ -0,0 +1,58 @@
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+#include "session.h"
+
+#define CONFIG_MAGIC 0x50434631     // "PCF1"
+#define CONFIG_VERSION 1
+#define CONFIG_PRESETS 4            // *sav 0 is also applied at power on
+
+// The credentials are at fixed places, written when the unit is set up and never by the
+// firmware. An SSID has at most 32 characters and a password 63, so the second half of
+// each field is free and holds the store.
+#define CONFIG_LEGACY_SSID 0
+#define CONFIG_LEGACY_PWD 128
+#define CONFIG_LEGACY_FIELD 128
+#define CONFIG_CREDENTIAL_MAX 63
+#define CONFIG_AREA_SIZE 64
+#define CONFIG_AREA(_N) ((_N) * CONFIG_LEGACY_FIELD + CONFIG_LEGACY_FIELD - CONFIG_AREA_SIZE)
+#define CONFIG_IMAGE_SIZE (2 * CONFIG_AREA_SIZE)
+#define CONFIG_EEPROM_SIZE (2 * CONFIG_LEGACY_FIELD)
+
+typedef enum CONFIG_KEY_T_ {
+    CONFIG_END = 0,
+    CONFIG_SSID,                    // read only, from its fixed field
+    CONFIG_PWD,                     // read only, from its fixed field
+    CONFIG_WIFI,                    // WIFI_CACHE_T
+    CONFIG_PRESET,                  // CONFIG_PRESET + n, CONFIG_PRESET_T
+    CONFIG_ERASED = 0xff
+} CONFIG_KEY_T;
+
+/*******************************************************************************************
+ * Start of the store, followed by key, length, value entries up to a CONFIG_END key.
+ * The CRC covers the entries. The header is written after the entries, so a save cut
+ * short leaves a store whose CRC does not match rather than one that reads wrongly.
+ * *****************************************************************************************/
+typedef struct CONFIG_HEADER_T_ {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t length;                 // of the entries
+    uint16_t crc;
+} CONFIG_HEADER_T;
+
+typedef struct CONFIG_PRESET_T_ {
+    float sample_rate;
+    uint8_t trig_channel;
+    uint8_t trig_type;
+    uint8_t reserved[2];
+} CONFIG_PRESET_T;
+
+uint16_t config_crc16(uint8_t const *data, size_t len);
+bool config_load(void);
+int config_get(uint8_t key, void *value, int max_len);
+bool config_get_string(uint8_t key, char *value, int size);
+bool config_set(uint8_t key, void const *value, int len);
+void config_apply_presets(void);
+bool config_command(LINK_T *link, uint8_t const *data, size_t len);
+
+#endif
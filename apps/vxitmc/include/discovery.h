@@ -0,0 +1,15 @@
+#ifndef __DISCOVERY_H__
+#define __DISCOVERY_H__
+
+#include "rpc_server.h"
+
+#define PORTMAP_PROGRAM 100000
+#define PORTMAP_GETPORT 3               // version 2 PMAPPROC_GETPORT and rpcbind GETADDR
+#define PORTMAP_PROTO_TCP 6
+
+#define MDNS_NAME_MAX 32
+
+bool portmap_reply(TCP_RPC_T *rpc_call, uint32_t len, RPC_REPLY_T *reply);
+void discovery_start(void);
+
+#endif
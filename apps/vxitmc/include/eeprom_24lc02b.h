@@ -1,8 +1,13 @@
 #ifndef __EEPROM_24LC02b_H__
 #define __EEPROM_24LC02b_H__
 
+#define EEPROM_PAGE_SIZE 8
+#define EEPROM_SIZE 256
+
 int initialise_eeprom(uint data_pin, uint clock_pin);
-int eeprom_read_block(uint8_t address, uint8_t *data);
-void dump_block(uint8_t* data);
+int eeprom_read(uint8_t address, uint8_t *data, int length);
+void eeprom_write_async(uint8_t address, uint8_t const *data, int length);
+void eeprom_write_async_last(uint8_t address, uint8_t const *data, int length);
+void eeprom_task(void);
 
-#endif
\ No newline at end of file
+#endif
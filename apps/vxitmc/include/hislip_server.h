@@ -0,0 +1,101 @@
+#ifndef __HISLIP_SERVER_H__
+#define __HISLIP_SERVER_H__
+
+#include "session.h"
+#include "command_buffer.h"
+
+#define HISLIP_PORT 4880
+#define HISLIP_VERSION 0x0100
+#define HISLIP_VENDOR_ID 0x5250     // "RP"
+#define HISLIP_HEADER_LEN 16
+#define HISLIP_CONTROL_PAYLOAD 64
+#define HISLIP_CONNECTIONS (2 * MAX_SESSIONS)
+
+// message types, IVI-6.1
+#define HISLIP_INITIALIZE                   0
+#define HISLIP_INITIALIZE_RESPONSE          1
+#define HISLIP_FATAL_ERROR                  2
+#define HISLIP_ERROR                        3
+#define HISLIP_ASYNC_LOCK                   4
+#define HISLIP_ASYNC_LOCK_RESPONSE          5
+#define HISLIP_DATA                         6
+#define HISLIP_DATA_END                     7
+#define HISLIP_DEVICE_CLEAR_COMPLETE        8
+#define HISLIP_DEVICE_CLEAR_ACKNOWLEDGE     9
+#define HISLIP_ASYNC_REMOTE_LOCAL_CONTROL   10
+#define HISLIP_ASYNC_REMOTE_LOCAL_RESPONSE  11
+#define HISLIP_TRIGGER                      12
+#define HISLIP_ASYNC_MAX_MSG_SIZE           15
+#define HISLIP_ASYNC_MAX_MSG_SIZE_RESPONSE  16
+#define HISLIP_ASYNC_INITIALIZE             17
+#define HISLIP_ASYNC_INITIALIZE_RESPONSE    18
+#define HISLIP_ASYNC_DEVICE_CLEAR           19
+#define HISLIP_ASYNC_SERVICE_REQUEST        20
+#define HISLIP_ASYNC_STATUS_QUERY           21
+#define HISLIP_ASYNC_STATUS_RESPONSE        22
+#define HISLIP_ASYNC_DEVICE_CLEAR_ACK       23
+#define HISLIP_ASYNC_LOCK_INFO              24
+#define HISLIP_ASYNC_LOCK_INFO_RESPONSE     25
+
+// codes of FatalError, the connection is closed after it
+#define HISLIP_FATAL_UNIDENTIFIED           0
+#define HISLIP_FATAL_BAD_HEADER             1
+#define HISLIP_FATAL_NOT_INITIALIZED        2
+#define HISLIP_FATAL_INVALID_INIT           3
+#define HISLIP_FATAL_MAX_SESSIONS           4
+
+// codes of Error, the connection stays open
+#define HISLIP_ERROR_UNIDENTIFIED           0
+#define HISLIP_ERROR_UNKNOWN_MESSAGE        1
+#define HISLIP_ERROR_UNKNOWN_CONTROL        2
+#define HISLIP_ERROR_UNKNOWN_VENDOR         3
+#define HISLIP_ERROR_MESSAGE_TOO_LARGE      4
+
+struct HISLIP_SESSION_T_;
+
+/*******************************************************************************************
+ * One TCP connection, either the synchronous or the asynchronous channel of a session.
+ * Which one is known from its first message.
+ * *****************************************************************************************/
+typedef struct HISLIP_CONN_T_ {
+    bool in_use;
+    struct tcp_pcb *pcb;
+    struct HISLIP_SESSION_T_ *hs;
+    bool async;
+
+    // received data not processed yet, held while a response is outstanding
+    struct pbuf *rx;
+
+    // message being received
+    uint8_t header[HISLIP_HEADER_LEN];
+    uint header_len;
+    uint64_t payload_left;
+    uint8_t payload[HISLIP_CONTROL_PAYLOAD];
+    uint payload_len;
+} HISLIP_CONN_T;
+
+/*******************************************************************************************
+ * One HiSLIP session, a link shared by its two channels. The synchronous channel sends
+ * through the session's reply queue, the asynchronous one only sends short messages.
+ * *****************************************************************************************/
+typedef struct HISLIP_SESSION_T_ {
+    bool in_use;
+    uint16_t id;
+    SESSION_T *session;
+    LINK_T *link;
+    HISLIP_CONN_T *sync;
+    HISLIP_CONN_T *async;
+
+    COMMAND_BUFFER_T command;
+    uint32_t message_id;
+    bool clearing;
+    uint8_t service_request_enable;
+
+    bool lock_pending;
+    absolute_time_t lock_deadline;
+} HISLIP_SESSION_T;
+
+bool hislip_server_open(void);
+void hislip_task(void);
+
+#endif
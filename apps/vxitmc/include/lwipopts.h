@@ -20,17 +20,29 @@
 #define MEM_LIBC_MALLOC             0
 #endif
 #define MEM_ALIGNMENT               4
-#define MEM_SIZE                    4000
-#define MEMP_NUM_TCP_SEG            32
 #define MEMP_NUM_ARP_QUEUE          10
-#define PBUF_POOL_SIZE              24
 #define LWIP_ARP                    1
 #define LWIP_ETHERNET               1
 #define LWIP_ICMP                   1
 #define LWIP_RAW                    1
-#define TCP_WND                     (8 * TCP_MSS)
 #define TCP_MSS                     1460
+#if NET_THROUGHPUT
+// Throughput profile, built with -DNET_THROUGHPUT=1. Captures are sent zero copy, so a
+// large send buffer costs segments and PBUF_REF headers rather than heap. The receive
+// window stays within the pbuf pool, which the capture buffer leaves no room to grow.
+#define MEM_SIZE                    8000
+#define TCP_SND_BUF                 (16 * TCP_MSS)
+#define TCP_WND                     (12 * TCP_MSS)
+#define MEMP_NUM_TCP_SEG            64
+#define MEMP_NUM_PBUF               64
+#define PBUF_POOL_SIZE              24
+#else
+#define MEM_SIZE                    4000
 #define TCP_SND_BUF                 (8 * TCP_MSS)
+#define TCP_WND                     (8 * TCP_MSS)
+#define MEMP_NUM_TCP_SEG            32
+#define PBUF_POOL_SIZE              24
+#endif
 #define TCP_SND_QUEUELEN            ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) / (TCP_MSS))
 #define LWIP_NETIF_STATUS_CALLBACK  1
 #define LWIP_NETIF_LINK_CALLBACK    1
@@ -47,9 +59,19 @@
 #define LWIP_TCP                    1
 #define LWIP_UDP                    1
 #define LWIP_DNS                    1
-// #define LWIP_MDNS_RESPONDER         LWIP_UDP
-// #define LWIP_NUM_NETIF_CLIENT_DATA  (LWIP_MDNS_RESPONDER)
+#define LWIP_MDNS_RESPONDER         LWIP_UDP
+#define LWIP_NUM_NETIF_CLIENT_DATA  (LWIP_MDNS_RESPONDER)
+#define MDNS_MAX_SERVICES           3
 #define LWIP_IGMP                   1
+// DHCP, DNS, mDNS and the portmapper
+#define MEMP_NUM_UDP_PCB            6
+// VXI-11 core and abort channels (MAX_SESSIONS), raw SCPI (MAX_SESSIONS) and HiSLIP
+// (HISLIP_CONNECTIONS), with a few to spare for connections in TIME_WAIT
+#define MEMP_NUM_TCP_PCB            (6 + 6 + 12 + 4)
+// the core, abort, SCPI and HiSLIP ports
+#define MEMP_NUM_TCP_PCB_LISTEN     4
+// without it the backlog given to tcp_listen_with_backlog() is ignored
+#define TCP_LISTEN_BACKLOG          1
 
 #ifdef CYW43_HOST_NAME
 #undef CYW43_HOST_NAME
@@ -61,7 +83,15 @@
 #define DHCP_DOES_ARP_CHECK         0
 #define LWIP_DHCP_DOES_ACD_CHECK    0
 
-#ifndef NDEBUG
+#if NET_THROUGHPUT
+// only the TCP counters, syst:netbench:res? reports retransmits from them
+#define LWIP_STATS                  1
+#define TCP_STATS                   1
+#define ETHARP_STATS                0
+#define IP_STATS                    0
+#define ICMP_STATS                  0
+#define UDP_STATS                   0
+#elif !defined(NDEBUG)
 #define LWIP_DEBUG                  1
 #define LWIP_STATS                  1
 #define LWIP_STATS_DISPLAY          1
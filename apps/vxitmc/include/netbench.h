@@ -0,0 +1,10 @@
+#ifndef __NETBENCH_H__
+#define __NETBENCH_H__
+
+#include "session.h"
+
+bool netbench_command(LINK_T *link, uint8_t const *data, size_t len);
+void netbench_sent(SESSION_T *session);
+size_t netbench_sink(LINK_T *link, size_t len);
+
+#endif
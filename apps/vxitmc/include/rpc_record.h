@@ -0,0 +1,38 @@
+#ifndef __RPC_RECORD_H__
+#define __RPC_RECORD_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// largest record that can be reassembled, a 1024 byte device_write plus its headers
+#define RPC_RECORD_WORDS 512
+#define RPC_LAST_FRAGMENT 0x80000000u
+
+/*******************************************************************************************
+ * Handler for a complete record. record points to a record marker for the whole record
+ * followed by the call, in network byte order and 4 byte aligned, len includes the
+ * marker. It is only valid during the call.
+ * *****************************************************************************************/
+typedef void (*rpc_record_handler_t)(void *arg, uint32_t *record, uint32_t len);
+
+/*******************************************************************************************
+ * Incremental ONC-RPC record marking decoder (RFC 5531 section 11). Bytes are fed as they
+ * arrive, in pieces of any size, fragments are joined and each complete record is handed
+ * to the handler, so several calls in one segment and one call over several segments
+ * both work.
+ * *****************************************************************************************/
+typedef struct RPC_RECORD_T_ {
+    uint32_t buffer[RPC_RECORD_WORDS];  // marker word followed by the reassembled record
+    uint32_t len;                       // record bytes in buffer, after the marker word
+    uint32_t fragment_left;             // bytes still to come in the current fragment
+    uint32_t marker;                    // fragment marker being received
+    uint8_t marker_len;                 // bytes of it received so far
+    bool last_fragment;
+    bool discard;                       // too large for buffer, skipped to its end
+} RPC_RECORD_T;
+
+void rpc_record_init(RPC_RECORD_T *rec);
+uint32_t rpc_record_feed(RPC_RECORD_T *rec, uint8_t const *data, size_t len, rpc_record_handler_t handler, void *arg);
+
+#endif
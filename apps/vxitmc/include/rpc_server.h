@@ -1,23 +1,20 @@
 #ifndef __RPC_SERVER_H__
 #define __RPC_SERVER_H__
 
+#include "rpc_record.h"
+
 #define TCP_PORT 111
-#define BUF_SIZE 128
 #define POLL_TIME_S 5
-#define DEBUG_printf 
+#define IDLE_WAKE_MS 10
+#define RPC_REPLY_MAX 128
+#define WIFI_PM_IDLE_MS 1000
 
 typedef struct TCP_SERVER_T_ {
     struct tcp_pcb *server_pcb;
-    struct tcp_pcb *client_pcb;
+    struct tcp_pcb *abort_pcb;
     bool complete;
-    uint32_t buffer_recv[BUF_SIZE];
-    int recv_len;
 } TCP_SERVER_T;
 
-const uint8_t *responseBuffer;
-uint responseBufferLen;
-
-
 typedef struct CREDENTIALS_T_ {
         uint32_t flavor;
         uint32_t length;
@@ -67,10 +64,29 @@ typedef struct send_t_ {
     uint32_t flags;
 } SEND_T;
 
+/*******************************************************************************************
+ * A short reply assembled behind its RPC header in one buffer, so that it is written with
+ * a single tcp_write() and leaves in a single segment
+ * *****************************************************************************************/
+typedef struct RPC_REPLY_T_ {
+    uint8_t data[RPC_REPLY_MAX];
+    uint len;
+} RPC_REPLY_T;
+
 err_t rpc_server_start(void);
-uint decode_string(void* buffer, uint8_t* string_data);
+uint decode_string(void* buffer, uint8_t* string_data, uint max_len);
 uint encode_string(const uint8_t* str, const uint str_len, void* buffer);
 void create_rpc_reply(TCP_RPC_REPLY_T* rpc_reply, uint32_t xid, uint32_t length);
+uint32_t *rpc_call_args(TCP_RPC_T *rpc_call, uint32_t len, uint *args_words);
 err_t send_data_list(struct tcp_pcb *tpcb, SEND_T * data, uint length);
+void rpc_reply_start(RPC_REPLY_T *reply, uint32_t xid);
+void rpc_reply_put(RPC_REPLY_T *reply, void const *data, uint len);
+void rpc_reply_put_u32(RPC_REPLY_T *reply, uint32_t value);
+void rpc_reply_put_string(RPC_REPLY_T *reply, void const *str, uint len);
+err_t rpc_reply_send(struct tcp_pcb *tpcb, RPC_REPLY_T *reply);
+
+struct SESSION_T_;
+err_t send_data_queued(struct SESSION_T_ *session, SEND_T *data, uint length);
+err_t send_queued(struct SESSION_T_ *session);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef __SCPI_SERVER_H__
+#define __SCPI_SERVER_H__
+
+#include "session.h"
+#include "command_buffer.h"
+
+#define SCPI_PORT 5025
+
+/*******************************************************************************************
+ * One raw socket client. Commands are newline terminated, except for the data of a
+ * "#<n><length>" block in an upload command, which may hold any bytes.
+ * *****************************************************************************************/
+typedef struct SCPI_CLIENT_T_ {
+    bool in_use;
+    SESSION_T *session;
+    LINK_T *link;
+
+    // received data not processed yet, held while a response is outstanding
+    struct pbuf *rx;
+
+    COMMAND_BUFFER_T command;
+} SCPI_CLIENT_T;
+
+bool scpi_server_open(void);
+void scpi_task(void);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+#include "pico/time.h"
+#include "rpc_server.h"
+#include "command_buffer.h"
+
+// a VXI-11 client may hold a second connection for its abort channel
+#define MAX_SESSIONS 6
+#define MAX_LINKS 8
+#define LINK_RESPONSE_MAX 64
+#define LINK_HEADER_MAX 16
+// longer replies built in buffers shared by every link, such as l:env?, are kept in one of
+// a few larger buffers until they have been written
+#define LINK_REPLY_SLOTS 2
+#define LINK_REPLY_MAX 2048
+#define SESSION_TX_PARTS 4
+#define SESSION_TX_HEADER (64 + LINK_RESPONSE_MAX)
+
+/*******************************************************************************************
+ * One TCP connection
+ * *****************************************************************************************/
+typedef struct SESSION_T_ {
+    bool in_use;
+    struct tcp_pcb *pcb;
+    RPC_RECORD_T record;
+
+    // reply being written as the send buffer frees up, see send_data_queued()
+    uint8_t tx_header[SESSION_TX_HEADER];
+    SEND_T tx[SESSION_TX_PARTS];
+    uint tx_count;
+    uint tx_index;
+    bool capture_sent;      // capture_buf was written zero copy, lwIP may still hold it
+} SESSION_T;
+
+/*******************************************************************************************
+ * One VXI-11 link. A connection can create several. Monitor links are read only: they
+ * may only send queries that do not change the analyser and they ignore the lock.
+ * *****************************************************************************************/
+typedef struct LINK_T_ {
+    bool in_use;
+    uint32_t id;
+    SESSION_T *session;
+    bool monitor;
+
+    // device_write data, put together until the write with END
+    COMMAND_BUFFER_T write;
+
+    // response to the last query, read by device_read
+    const uint8_t *response_header;
+    uint response_header_len;
+    const uint8_t *response;
+    uint response_len;
+    uint8_t response_copy[LINK_RESPONSE_MAX];
+    uint8_t response_header_copy[LINK_HEADER_MAX];
+    uint chunk_offset;
+    bool response_ready;
+
+    // device_read held until the response is ready
+    bool read_pending;
+    uint32_t read_xid;
+    uint32_t read_size;
+    absolute_time_t read_deadline;
+
+    // device_lock or create_link held until the lock is free
+    bool lock_pending;
+    uint32_t lock_xid;
+    uint32_t lock_procedure;
+    absolute_time_t lock_deadline;
+} LINK_T;
+
+SESSION_T *session_open(struct tcp_pcb *pcb);
+void session_close(SESSION_T *session);
+
+LINK_T *link_create(SESSION_T *session, bool monitor);
+LINK_T *link_find(SESSION_T *session, uint32_t id);
+LINK_T *link_at(uint index);
+LINK_T *link_by_id(uint32_t id);
+void link_destroy(LINK_T *link);
+bool link_lock(LINK_T *link);
+bool link_unlock(LINK_T *link);
+bool link_locked_out(LINK_T *link);
+void link_process_command(LINK_T *link, uint8_t *data, size_t len);
+void link_set_response(LINK_T *link, uint8_t const *header, size_t header_len, uint8_t const *data, size_t data_len);
+bool link_response_pending(LINK_T *link);
+void link_cancel_response(LINK_T *link);
+bool link_response_sent(LINK_T *link);
+LINK_T *link_lock_owner(void);
+bool session_capture_held(void);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef __UDP_STREAM_H__
+#define __UDP_STREAM_H__
+
+#include "session.h"
+
+#define UDP_STREAM_MAGIC 0x504c5331     // "PLS1"
+#define UDP_STREAM_PAYLOAD 1024         // samples per datagram, a stream block is 4
+#define UDP_STREAM_FLAG_GAP 1           // blocks were dropped before this block
+
+/*******************************************************************************************
+ * Header of every stream datagram, in network byte order. sequence counts datagrams, a
+ * gap in it is a datagram lost on the way. block is the stream block the samples come
+ * from, a jump in it is blocks the Pico dropped. Every datagram of the first block after
+ * such a jump has UDP_STREAM_FLAG_GAP, and overruns counts the blocks dropped so far.
+ * *****************************************************************************************/
+typedef struct UDP_STREAM_HEADER_T_ {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t block;
+    uint16_t offset;        // of the samples in the block
+    uint16_t flags;
+    uint32_t overruns;      // blocks dropped since the stream started
+} UDP_STREAM_HEADER_T;
+
+bool udp_stream_command(LINK_T *link, uint8_t const *data, size_t len);
+void udp_stream_task(void);
+
+#endif
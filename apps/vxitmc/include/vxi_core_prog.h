@@ -1,8 +1,12 @@
 #ifndef __VXI_CORE_PROH_H__
 #define __VXI_CORE_PROH_H__
 
-uint max_read_size;
-uint chunk_offset;
+#include "session.h"
+
+#define VXI_CORE_PROGRAM 395183
+#define VXI_ASYNC_PROGRAM 395184
+#define VXI_ABORT_PORT 333
+#define VXI_MESSAGE_MAX 1024        // message_max_length, each device_write fits in a record
 
 typedef struct DEVICE_WRITE_PARAMS_T_ {
     uint32_t link_id;
@@ -52,6 +56,25 @@ typedef struct DESTROY_LINK_PARAMS_REPLY_T_ {
     uint32_t error;
 } DESTROY_LINK_PARAMS_REPLY_T;
 
-err_t decode_vxi(TCP_SERVER_T *state, struct tcp_pcb *tpcb, TCP_RPC_T* rpc_call, uint32_t* buffer);
+typedef struct DEVICE_LOCK_PARAMS_T_ {
+    uint32_t link_id;
+    uint32_t flags;
+    uint32_t lock_timeout;
+} DEVICE_LOCK_PARAMS_T;
+
+typedef struct DEVICE_GENERIC_PARAMS_T_ {
+    uint32_t link_id;
+    uint32_t flags;
+    uint32_t lock_timeout;
+    uint32_t io_timeout;
+} DEVICE_GENERIC_PARAMS_T;
+
+typedef struct DEVICE_ERROR_T_ {
+    uint32_t error;
+} DEVICE_ERROR_T;
+
+err_t decode_vxi(SESSION_T *session, struct tcp_pcb *tpcb, TCP_RPC_T* rpc_call, uint32_t len);
+err_t decode_vxi_abort(struct tcp_pcb *tpcb, TCP_RPC_T* rpc_call, uint32_t len);
+void vxi_task();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef __WIFI_H__
+#define __WIFI_H__
+
+#include "session.h"
+
+#define WIFI_JOIN_MS 30000
+#define WIFI_FAST_JOIN_MS 3000
+
+// where an EEPROM without a config store keeps the cache, in the SSID field past the longest SSID
+#define WIFI_CACHE_ADDRESS 64
+#define WIFI_CACHE_MAGIC 0x57464331     // "WFC1"
+#define WIFI_CACHE_STATIC 1             // the address was configured, DHCP is not used
+
+/*******************************************************************************************
+ * What the last successful join used, kept so the next boot can skip the scan and DHCP.
+ * Addresses are in network byte order.
+ * *****************************************************************************************/
+typedef struct WIFI_CACHE_T_ {
+    uint32_t magic;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t flags;
+    uint32_t ip;
+    uint32_t netmask;
+    uint32_t gateway;
+    uint16_t ssid_check;    // CRC of the SSID, the cache is dropped when it changes
+    uint16_t crc;
+    uint32_t reserved;
+} WIFI_CACHE_T;
+
+typedef enum BOOT_EVENT_T_ {
+    BOOT_LINK_UP,           // joined and with an address
+    BOOT_LISTENING,         // servers open
+    BOOT_FIRST_RESPONSE,    // first response to a client
+    BOOT_EVENT_COUNT
+} BOOT_EVENT_T;
+
+void wifi_load_cache(void);
+int wifi_connect(const char *ssid, const char *pwd);
+void boot_mark(BOOT_EVENT_T event);
+bool wifi_command(LINK_T *link, uint8_t const *data, size_t len);
+
+#endif
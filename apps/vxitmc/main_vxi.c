@@ -10,18 +10,20 @@
 #include "lwip/apps/mdns.h"
 
 #include "rpc_server.h"
+#include "log.h"
+#include "commands.h"
+#include "wifi.h"
+#include "config.h"
 #ifdef ENABLE_EEPROM
 #include "eeprom_24lc02b.h"
 #endif
 
-#define DEBUG_printf printf
 #define TEST_ITERATIONS 10
 #define POLL_TIME_S 5
 
 #define I2C_SDA_PIN 18
 #define I2C_SCL_PIN 19
 
-void initialise_commands();
 
 typedef struct WIFI_DATA_T_ {
     uint8_t ssid[128];
@@ -38,13 +40,13 @@ void get_wifi_credentials()
 #endif
 #ifdef ENABLE_EEPROM
         initialise_eeprom(I2C_SDA_PIN, I2C_SCL_PIN);
-        uint8_t raw_data[256];
-        if(eeprom_read_block(0, raw_data) >0)
+        if(config_load())
         {
-            dump_block(raw_data);
-            strcpy(wifi_data.ssid, &raw_data[0]);
-            strcpy(wifi_data.pwd, &raw_data[128]);
-            DEBUG_printf("Wifi: %s %s\n",wifi_data.ssid, wifi_data.pwd);
+            config_get_string(CONFIG_SSID, (char *)wifi_data.ssid, sizeof(wifi_data.ssid));
+            config_get_string(CONFIG_PWD, (char *)wifi_data.pwd, sizeof(wifi_data.pwd));
+            wifi_load_cache();
+            config_apply_presets();
+            printf("Wifi: %s\n",wifi_data.ssid);
         }
         else
         {
@@ -87,7 +89,7 @@ err_t start_networking()
     err_t err = ERR_OK;
     get_wifi_credentials();
     printf("Connecting to WiFi...\n");
-    err = cyw43_arch_wifi_connect_timeout_ms(wifi_data.ssid, wifi_data.pwd, CYW43_AUTH_WPA2_AES_PSK, 30000);
+    err = wifi_connect((const char *)wifi_data.ssid, (const char *)wifi_data.pwd);
     if (err)
     {
         gpio_put(21, 1);
@@ -99,7 +101,7 @@ err_t start_networking()
         err = rpc_server_start();
         if(err != ERR_OK)
         {
-            DEBUG_printf("Failed to run\n");
+            LOG_ERROR(LOG_SERVER_FAILED);
         }
     }
     return err;
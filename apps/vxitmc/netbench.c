@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pico/stdlib.h>
+
+#include "lwip/tcp.h"
+#include "lwip/stats.h"
+
+#include "netbench.h"
+#include "commands.h"
+
+/*******************************************************************************************
+ * One benchmark run on one link. A source run sends a block of synthetic data and ends
+ * when the client has read and acknowledged all of it, a sink run takes the next bytes the
+ * client sends and drops them. Only the payload is counted, not the transport framing.
+ * *****************************************************************************************/
+typedef struct NETBENCH_T_ {
+    LINK_T *link;
+    bool running;
+    bool sink;
+    uint32_t bytes;
+    uint32_t done;
+    uint64_t start_us;
+    uint64_t end_us;
+    uint32_t rexmit_start;
+    uint32_t rexmit;
+} NETBENCH_T;
+
+static NETBENCH_T bench;
+static uint8_t bench_header[12];    // "#6nnnnnn"
+static uint8_t result_buf[64];      // "4294967295,4294967295,9999.999,4294967295\r\n"
+
+static uint32_t retransmits(void)
+{
+#if LWIP_STATS && TCP_STATS
+    return lwip_stats.tcp.rexmit;
+#else
+    return 0;
+#endif
+}
+
+static void bench_start(LINK_T *link, bool sink, uint32_t bytes)
+{
+    memset(&bench, 0, sizeof(bench));
+    bench.link = link;
+    bench.sink = sink;
+    bench.bytes = bytes;
+    bench.running = true;
+    bench.start_us = time_us_64();
+    bench.rexmit_start = retransmits();
+}
+
+static void bench_end(void)
+{
+    bench.end_us = time_us_64();
+    bench.rexmit = retransmits() - bench.rexmit_start;
+    bench.running = false;
+}
+
+/*******************************************************************************************
+ * syst:netbench? <bytes>      - source, answers with a block of <bytes> from the capture
+ *                               buffer, which only stands in for data and is not changed
+ * syst:netbench:sink <bytes>  - sink, times the next <bytes> of data the client sends on
+ *                               this link and drops them, they are not run as commands
+ * syst:netbench:res?          - <bytes>,<us>,<MB/s>,<retransmits> of the last run
+ * Returns false if the command is not one of these.
+ * *****************************************************************************************/
+bool netbench_command(LINK_T *link, uint8_t const *data, size_t len)
+{
+    if(len >= 18 && !strncasecmp("syst:netbench:res?", (char const*)data, 18))
+    {
+        uint64_t us = bench.end_us > bench.start_us ? bench.end_us - bench.start_us : 0;
+        float mbps = us ? (float)bench.done / us : 0.0f;
+        sprintf((char*)result_buf, "%lu,%lu,%.3f,%lu\r\n", (unsigned long)bench.done,
+                (unsigned long)us, mbps, (unsigned long)bench.rexmit);
+        link_set_response(link, NULL, 0, result_buf, strlen((char*)result_buf));
+        return true;
+    }
+    if(len >= 18 && !strncasecmp("syst:netbench:sink", (char const*)data, 18))
+    {
+        bench_start(link, true, atoi((char const*)data + 18));
+        bench.start_us = 0;     // from the first byte that arrives
+        bench.running = bench.bytes != 0;
+        return true;
+    }
+    if(len >= 14 && !strncasecmp("syst:netbench?", (char const*)data, 14))
+    {
+        size_t buffer_len;
+        uint8_t const *buffer = capture_buffer(&buffer_len);
+        uint32_t bytes = MIN((uint32_t)atoi((char const*)data + 14), buffer_len);
+        size_t header_len = sprintf((char*)bench_header, "#6%06lu", (unsigned long)bytes);
+
+        bench_start(link, false, bytes + header_len);
+        link_set_response(link, bench_header, header_len, buffer, bytes);
+        return true;
+    }
+    return false;
+}
+
+/*******************************************************************************************
+ * The client acknowledged some data. The source run is over once it has read the whole
+ * response and nothing it was sent is left unacknowledged.
+ * *****************************************************************************************/
+void netbench_sent(SESSION_T *session)
+{
+    if(!bench.running || bench.sink || !bench.link->in_use || bench.link->session != session)
+        return;
+    if(link_response_sent(bench.link))
+    {
+        bench.done = bench.bytes;
+        bench_end();
+    }
+}
+
+/*******************************************************************************************
+ * Offer len bytes of data the link received to a sink run. Returns how many it took, they
+ * are counted and dropped and must not reach the command buffer.
+ * *****************************************************************************************/
+size_t netbench_sink(LINK_T *link, size_t len)
+{
+    if(!bench.running || !bench.sink || bench.link != link)
+        return 0;
+    if(!bench.start_us)
+        bench.start_us = time_us_64();
+    size_t n = MIN(len, bench.bytes - bench.done);
+    bench.done += n;
+    if(bench.done == bench.bytes)
+        bench_end();
+    return n;
+}
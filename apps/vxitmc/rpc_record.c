@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "rpc_record.h"
+
+// no SDK headers, so the decoder also builds for the host tests in test/
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+static uint32_t get_be32(uint8_t const *data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static void put_be32(uint32_t *word, uint32_t value)
+{
+    uint8_t *data = (uint8_t*)word;
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+void rpc_record_init(RPC_RECORD_T *rec)
+{
+    rec->len = 0;
+    rec->fragment_left = 0;
+    rec->marker = 0;
+    rec->marker_len = 0;
+    rec->last_fragment = false;
+    rec->discard = false;
+}
+
+/*******************************************************************************************
+ * Feed received bytes to the decoder, calling handler for every record completed. A
+ * record that is in one piece, in one fragment and 4 byte aligned is handed over where it
+ * lies, anything else is copied into rec->buffer first. Returns the number of records
+ * dropped because they did not fit.
+ * *****************************************************************************************/
+uint32_t rpc_record_feed(RPC_RECORD_T *rec, uint8_t const *data, size_t len, rpc_record_handler_t handler, void *arg)
+{
+    uint32_t discarded = 0;
+
+    while(len)
+    {
+        if(rec->marker_len == 0 && rec->len == 0 && len >= 4 && ((uintptr_t)data & 3) == 0)
+        {
+            uint32_t marker = get_be32(data);
+            uint32_t fragment_len = marker & ~RPC_LAST_FRAGMENT;
+            if((marker & RPC_LAST_FRAGMENT) && len - 4 >= fragment_len && fragment_len <= sizeof(rec->buffer) - 4)
+            {
+                handler(arg, (uint32_t*)data, fragment_len + 4);
+                data += fragment_len + 4;
+                len -= fragment_len + 4;
+                continue;
+            }
+        }
+
+        if(rec->marker_len < 4)
+        {
+            rec->marker = (rec->marker << 8) | *data++;
+            len--;
+            if(++rec->marker_len < 4)
+                continue;
+
+            rec->fragment_left = rec->marker & ~RPC_LAST_FRAGMENT;
+            rec->last_fragment = (rec->marker & RPC_LAST_FRAGMENT) != 0;
+            if(rec->fragment_left > sizeof(rec->buffer) - 4 - rec->len)
+                rec->discard = true;
+        }
+        else
+        {
+            uint32_t n = MIN(len, rec->fragment_left);
+            if(!rec->discard)
+            {
+                memcpy((uint8_t*)rec->buffer + 4 + rec->len, data, n);
+                rec->len += n;
+            }
+            data += n;
+            len -= n;
+            rec->fragment_left -= n;
+        }
+
+        if(rec->fragment_left == 0)
+        {
+            rec->marker = 0;
+            rec->marker_len = 0;
+            if(rec->last_fragment)
+            {
+                if(rec->discard)
+                {
+                    discarded++;
+                }
+                else
+                {
+                    put_be32(&rec->buffer[0], RPC_LAST_FRAGMENT | rec->len);
+                    handler(arg, rec->buffer, rec->len + 4);
+                }
+                rec->len = 0;
+                rec->discard = false;
+            }
+        }
+    }
+    return discarded;
+}
@@ -1,14 +1,25 @@
 #include <stdlib.h>
+#include <string.h>
 #include <pico/stdlib.h>
 
 #include "pico/cyw43_arch.h"
 #include "lwip/pbuf.h"
 #include "lwip/tcp.h"
 #include "lwip/netif.h"
-#include "lwip/apps/mdns.h"
 
 #include "rpc_server.h"
 #include "vxi_core_prog.h"
+#include "scpi_server.h"
+#include "hislip_server.h"
+#include "discovery.h"
+#include "netbench.h"
+#include "udp_stream.h"
+#include "wifi.h"
+#ifdef ENABLE_EEPROM
+#include "eeprom_24lc02b.h"
+#endif
+#include "log.h"
+#include "commands.h"
 
 TCP_SERVER_T* tcp_server_init(void);
 bool tcp_server_open(void *arg);
@@ -18,9 +29,76 @@ void tcp_server_err(void *arg, err_t err);
 err_t tcp_server_poll(void *arg, struct tcp_pcb *tpcb);
 err_t tcp_server_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
 
-uint get_address(uint32_t program, void* buffer);
+#if MEMP_NUM_TCP_PCB < 2 * MAX_SESSIONS + HISLIP_CONNECTIONS
+#error "MEMP_NUM_TCP_PCB in lwipopts.h is too small for the sessions and HiSLIP connections"
+#endif
 
-err_t decode_buffer(struct tcp_pcb *tpcb, TCP_SERVER_T *state);
+err_t decode_buffer(struct tcp_pcb *tpcb, SESSION_T *session, uint32_t *buffer, uint32_t len);
+void tcp_server_close_session(SESSION_T *session);
+void decode_record(void *arg, uint32_t *record, uint32_t len);
+
+#if NET_THROUGHPUT
+static bool wifi_busy;
+static absolute_time_t wifi_idle_at;
+
+/*******************************************************************************************
+ * WiFi power save is off while large replies go out. In power save the chip sleeps
+ * between beacons, so ACKs, and with them the send window, come back late.
+ * *****************************************************************************************/
+static void wifi_transfer_started(void)
+{
+    wifi_idle_at = make_timeout_time_ms(WIFI_PM_IDLE_MS);
+    if(!wifi_busy)
+    {
+        cyw43_wifi_pm(&cyw43_state, CYW43_PERFORMANCE_PM);
+        wifi_busy = true;
+    }
+}
+
+static void wifi_transfer_check(void)
+{
+    if(wifi_busy && time_reached(wifi_idle_at))
+    {
+        cyw43_wifi_pm(&cyw43_state, CYW43_DEFAULT_PM);
+        wifi_busy = false;
+    }
+}
+#endif
+
+/*******************************************************************************************
+ * Work that follows from something a client sent or a capture completing. The deadlines
+ * these tasks check are only looked at when the loop wakes, at least every IDLE_WAKE_MS.
+ * *****************************************************************************************/
+static void server_tasks(void)
+{
+    analyser_task();
+    vxi_task();
+    scpi_task();
+    hislip_task();
+    udp_stream_task();
+#ifdef ENABLE_EEPROM
+    eeprom_task();
+#endif
+#if NET_THROUGHPUT
+    wifi_transfer_check();
+#endif
+}
+
+static void capture_work(async_context_t *context, async_when_pending_worker_t *worker)
+{
+    server_tasks();
+}
+
+static async_when_pending_worker_t capture_worker = { .do_work = capture_work };
+
+/*******************************************************************************************
+ * From the DMA interrupt: the response to a waiting query goes out from the next
+ * cyw43_arch_poll(), without waiting for the loop to come round
+ * *****************************************************************************************/
+static void capture_event(void)
+{
+    async_context_set_work_pending(cyw43_arch_async_context(), &capture_worker);
+}
 
 err_t rpc_server_start(void) 
 {
@@ -31,71 +109,100 @@ err_t rpc_server_start(void)
     if (!tcp_server_open(state)) {
         return ERR_CONN;
     }
+    if (!scpi_server_open()) {
+        return ERR_CONN;
+    }
+    if (!hislip_server_open()) {
+        return ERR_CONN;
+    }
+
+    discovery_start();
+    boot_mark(BOOT_LISTENING);
+
+    async_context_add_when_pending_worker(cyw43_arch_async_context(), &capture_worker);
+    set_capture_notify(capture_event);
+    set_capture_hold(session_capture_held);
 
     while(!state->complete) {
         cyw43_arch_poll();
-        sleep_ms(1);
+        server_tasks();
+        log_task();
+        // sleep until the WiFi chip, a DMA or a timer interrupt has work for us
+        cyw43_arch_wait_for_work_until(make_timeout_time_ms(IDLE_WAKE_MS));
     }
-    
-    free(state);
+
     return ERR_OK;
 }
 
 TCP_SERVER_T* tcp_server_init(void)
 {
-    TCP_SERVER_T *state = calloc(1, sizeof(TCP_SERVER_T));
-    if (!state) {
-        DEBUG_printf("failed to allocate state\n");
-        return NULL;
-    }
-    return state;
+    static TCP_SERVER_T server_state;
+    memset(&server_state, 0, sizeof(server_state));
+    return &server_state;
 }
 
-bool tcp_server_open(void *arg)
+static struct tcp_pcb *tcp_server_listen(TCP_SERVER_T *state, u16_t port)
 {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
-    printf("Starting server at %s on port %u\n", ip4addr_ntoa(netif_ip4_addr(netif_list)), TCP_PORT);
-    gpio_put(20, 1);
-
-
     struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
     if (!pcb) {
-        DEBUG_printf("failed to create pcb\n");
-        return false;
+        LOG_ERROR(LOG_PCB_FAILED);
+        return NULL;
     }
 
-    err_t err = tcp_bind(pcb, NULL, TCP_PORT);
+    err_t err = tcp_bind(pcb, NULL, port);
     if (err) {
-        DEBUG_printf("failed to bind to port %d\n");
-        return false;
+        LOG_ERROR(LOG_BIND_FAILED, port);
+        return NULL;
     }
 
-    state->server_pcb = tcp_listen_with_backlog(pcb, 1);
-    if (!state->server_pcb) {
-        DEBUG_printf("failed to listen\n");
-        if (pcb) {
-            tcp_close(pcb);
-        }
-        return false;
+    struct tcp_pcb *listen_pcb = tcp_listen_with_backlog(pcb, MAX_SESSIONS);
+    if (!listen_pcb) {
+        LOG_ERROR(LOG_LISTEN_FAILED);
+        tcp_close(pcb);
+        return NULL;
     }
 
-    tcp_arg(state->server_pcb, state);
-    tcp_accept(state->server_pcb, tcp_server_accept);
+    tcp_arg(listen_pcb, state);
+    tcp_accept(listen_pcb, tcp_server_accept);
+    return listen_pcb;
+}
+
+/*******************************************************************************************
+ * The portmapper and the VXI-11 core channel share port 111, the abort channel has the
+ * port that create_link hands out. Connections to either are decoded the same way.
+ * *****************************************************************************************/
+bool tcp_server_open(void *arg)
+{
+    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
+    printf("Starting server at %s on port %u\n", ip4addr_ntoa(netif_ip4_addr(netif_list)), TCP_PORT);
+    gpio_put(20, 1);
 
-    return true;
+    state->server_pcb = tcp_server_listen(state, TCP_PORT);
+    if (!state->server_pcb)
+        return false;
+    state->abort_pcb = tcp_server_listen(state, VXI_ABORT_PORT);
+    return state->abort_pcb != NULL;
 }
 
 err_t tcp_server_accept(void *arg, struct tcp_pcb *client_pcb, err_t err)
 {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
     if (err != ERR_OK || client_pcb == NULL) {
-        DEBUG_printf("Failure in accept %d\n", err);
+        LOG_ERROR(LOG_ACCEPT_FAILED, err);
         return err;
     }
-    DEBUG_printf("Client connected\n");
 
-    state->client_pcb = client_pcb;
-    tcp_arg(client_pcb, state);
+    // each connection gets its own session, refuse the connection when they are all in use
+    SESSION_T *session = session_open(client_pcb);
+    if (!session) {
+        LOG_WARN(LOG_SESSION_FULL);
+        tcp_abort(client_pcb);
+        return ERR_ABRT;
+    }
+    LOG_INFO(LOG_CLIENT_CONNECTED);
+
+    // queries are answered with one short segment, send it without waiting for an ACK
+    tcp_nagle_disable(client_pcb);
+    tcp_arg(client_pcb, session);
     tcp_sent(client_pcb, tcp_server_sent);
     tcp_recv(client_pcb, tcp_server_recv);
     tcp_poll(client_pcb, tcp_server_poll, POLL_TIME_S * 2);
@@ -106,174 +213,169 @@ err_t tcp_server_accept(void *arg, struct tcp_pcb *client_pcb, err_t err)
 
 err_t tcp_server_sent(void *arg, struct tcp_pcb *tpcb, u16_t len)
 {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
-    DEBUG_printf("tcp_server_sent %u\n", len);
-    
+    SESSION_T *session = (SESSION_T*)arg;
+    LOG_DEBUG(LOG_TCP_SENT, len);
+
+    if(session)
+        netbench_sent(session);
+    // the client has acknowledged some data, queue more of the reply in its place
+    if(session && session->tx_count)
+        return send_queued(session);
     return ERR_OK;
 }
 
 err_t tcp_server_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
 {
-    TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
-    uint16_t recevied_count;
+    SESSION_T *session = (SESSION_T*)arg;
     // this method is callback from lwIP, so cyw43_arch_lwip_begin is not required, however you
     // can use this method to cause an assertion in debug mode, if this method is called when
     // cyw43_arch_lwip_begin IS needed
     cyw43_arch_lwip_check();
     if ( p == NULL)
     {
-        DEBUG_printf("EOF\n");
-        tcp_close(state->client_pcb);
+        LOG_DEBUG(LOG_TCP_EOF);
+        session->tx_count = 0;
+        tcp_server_close_session(session);
+        // the session may be reused before lwIP is done with this pcb
+        tcp_arg(tpcb, NULL);
+        tcp_recv(tpcb, NULL);
+        tcp_close(tpcb);
     }
-    else if(p->tot_len > 0) 
+    else if(session->tx_count)
     {
-        DEBUG_printf("Received %d bytes\n", p->len);
-        DEBUG_printf("tcp_server_recv %d/%d err %d\n", p->tot_len, state->recv_len, err);
-
-        // Receive the buffer
-        const uint16_t buffer_left = BUF_SIZE - state->recv_len;
-        recevied_count = pbuf_copy_partial(p, state->buffer_recv + state->recv_len, p->tot_len > buffer_left ? buffer_left : p->tot_len, 0);
-        if (recevied_count > 0)
-        {
-            state->recv_len += recevied_count;
-        }
-        else
+        // replies must not be interleaved, lwIP offers the data again later
+        LOG_DEBUG(LOG_TCP_RECV_HELD, p->tot_len);
+        return ERR_MEM;
+    }
+    else
+    {
+        LOG_DEBUG(LOG_TCP_RECV, p->tot_len, session->record.len, err);
+        // decode straight from the pbuf chain, any number of calls may complete here
+        for(struct pbuf *q = p; q != NULL; q = q->next)
         {
-            DEBUG_printf("Error copying pbuf 0x%08x\n", p);
+            uint32_t discarded = rpc_record_feed(&session->record, q->payload, q->len, decode_record, session);
+            if(discarded)
+                LOG_WARN(LOG_RPC_TOO_LARGE, discarded);
         }
         tcp_recved(tpcb, p->tot_len);
-    }
-    pbuf_free(p);
-
-    // Have we have received the whole buffer
-    if (state->recv_len == p->tot_len) {
-        DEBUG_printf("Received all the bytes\n");
-        state->recv_len = 0;
-        err_t ret  = decode_buffer(tpcb, state);
-        return ret;
+        pbuf_free(p);
     }
     return ERR_OK;
 }
 
+void decode_record(void *arg, uint32_t *record, uint32_t len)
+{
+    SESSION_T *session = (SESSION_T*)arg;
+
+    // shorter than the call header, the program fields are not there
+    if(len < sizeof(TCP_RPC_T) - sizeof(void*))
+    {
+        LOG_WARN(LOG_RPC_SHORT, len);
+        return;
+    }
+    decode_buffer(session->pcb, session, record, len);
+}
+
 err_t tcp_server_poll(void *arg, struct tcp_pcb *tpcb)
 {
+    SESSION_T *session = (SESSION_T*)arg;
     if(tpcb->state == CLOSE_WAIT )
     {
-        TCP_SERVER_T *state = (TCP_SERVER_T*)arg;
-        if(state->client_pcb)
+        if(session && session->pcb)
         {
-            tcp_abort(state->client_pcb);
-            tcp_sent(state->client_pcb, NULL);
-            tcp_recv(state->client_pcb, NULL);
-            tcp_poll(state->client_pcb, NULL, POLL_TIME_S * 2);
-            tcp_err(state->client_pcb, NULL);
-            state->client_pcb = NULL;
-            DEBUG_printf("CLOSE_WAIT\n");
+            tcp_server_close_session(session);
+            tcp_sent(tpcb, NULL);
+            tcp_recv(tpcb, NULL);
+            tcp_poll(tpcb, NULL, POLL_TIME_S * 2);
+            tcp_err(tpcb, NULL);
+            tcp_abort(tpcb);
+            LOG_DEBUG(LOG_TCP_CLOSE_WAIT);
+            return ERR_ABRT;
         }
     }
+    // retry a reply that stalled with nothing in flight to trigger tcp_server_sent()
+    else if(session && session->tx_count)
+        return send_queued(session);
     return ERR_OK;
 }
 
 void tcp_server_err(void *arg, err_t err)
 {
-    DEBUG_printf("tc p_client_err_fn %d\n", err);
+    SESSION_T *session = (SESSION_T*)arg;
+    LOG_WARN(LOG_TCP_ERR, err);
+    // lwIP has already freed the pcb
+    if(session && session->pcb)
+    {
+        session->pcb = NULL;
+        tcp_server_close_session(session);
+    }
+}
+
+/*******************************************************************************************
+ * Release the session and its links, the lock goes with them
+ * *****************************************************************************************/
+void tcp_server_close_session(SESSION_T *session)
+{
+    if(session && session->in_use)
+        session_close(session);
 }
 
-err_t decode_buffer(struct tcp_pcb *tpcb, TCP_SERVER_T *state)
+err_t decode_buffer(struct tcp_pcb *tpcb, SESSION_T *session, uint32_t *buffer, uint32_t len)
 {
-    uint32_t* buffer = state->buffer_recv;
     TCP_RPC_T* rpc_call = (TCP_RPC_T*)buffer;
-    TCP_RPC_REPLY_T rpc_reply;
-    uint32_t* ptr32 = (uint32_t*)(&rpc_call->the_rest);
-    uint32_t prog = *ptr32;
     uint program = htonl(rpc_call->program);
-    DEBUG_printf("RPC CALL: xid=0x%08x\n program=0x%08x\n procedure=%d\n portmap prog=%d\n", htonl(rpc_call->xid), htonl(rpc_call->program), htonl(rpc_call->procedure), htonl(prog));
-    if (program == 100000)
+    LOG_DEBUG(LOG_RPC_CALL, htonl(rpc_call->xid), htonl(rpc_call->program), htonl(rpc_call->procedure),
+              htonl(*(uint32_t*)&rpc_call->the_rest));
+    if (program == PORTMAP_PROGRAM)
     {
-        if(htonl(rpc_call->procedure) == 3)
-        {
-            if(htonl(rpc_call->version) == 4)
-            {
-                DEBUG_printf("GETADDR\n");
-                SEND_T send_data[2];
-                uint32_t address[16];
-                uint len = get_address(htonl(prog), (void*) &address);
-                create_rpc_reply(&rpc_reply, rpc_call->xid, sizeof(TCP_RPC_REPLY_T) - 4 +len);
-
-                send_data[0].ptr = (void*)&rpc_reply;
-                send_data[0].length = sizeof(TCP_RPC_REPLY_T);
-                send_data[0].flags = TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE;
-
-                send_data[1].ptr = (void*)&address;
-                send_data[1].length = len;
-                send_data[1].flags = TCP_WRITE_FLAG_COPY;
-                    
-                return send_data_list(tpcb, send_data, 2);
-            }
-            else if(htonl(rpc_call->version) == 2)
-            {
-                DEBUG_printf("GETPORT\n");
-                SEND_T send_data[2];
-                GETPORT_REPLY_T getport_reply;
-                create_rpc_reply(&rpc_reply, rpc_call->xid, sizeof(TCP_RPC_REPLY_T) + sizeof(GETPORT_REPLY_T) - 4);
-                send_data[0].ptr = (void*)&rpc_reply;
-                send_data[0].length = sizeof(TCP_RPC_REPLY_T);
-                send_data[0].flags = TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE;
-
-                getport_reply.port = htonl(111);
-
-                send_data[1].ptr = (void*)&getport_reply;
-                send_data[1].length = sizeof(GETPORT_REPLY_T);
-                send_data[1].flags = TCP_WRITE_FLAG_COPY;
-                
-                return send_data_list(tpcb, send_data, 2);
-            }
-        }
+        RPC_REPLY_T reply;
+        if(portmap_reply(rpc_call, len, &reply))
+            return rpc_reply_send(tpcb, &reply);
+        LOG_WARN(LOG_RPC_UNKNOWN, program, htonl(rpc_call->procedure));
+    }
+    else if (program == VXI_CORE_PROGRAM)
+    {
+        return decode_vxi(session, tpcb, rpc_call, len);
     }
-    else if (program == 395183)
+    else if (program == VXI_ASYNC_PROGRAM)
     {
-        return decode_vxi(state, tpcb, rpc_call, buffer);
+        return decode_vxi_abort(tpcb, rpc_call, len);
     }
     else
     {
-        DEBUG_printf("Uknown call prog %d -> procedure %d\n", rpc_call->program, rpc_call->procedure);
+        LOG_WARN(LOG_RPC_UNKNOWN, htonl(rpc_call->program), htonl(rpc_call->procedure));
     }
-    
-    DEBUG_printf("<-decode_buffer ERR_OK\n");
-    return ERR_OK;
-}
 
-uint get_address(uint32_t program, void* buffer)
-{
-    const uint8_t* address = "192.168.1.46.0.111";
-    DEBUG_printf("Get address %d\n", program);
-    return encode_string(address, strlen(address), buffer);
+    return ERR_OK;
 }
 
 uint encode_string(const uint8_t* str, const uint str_len, void* buffer)
 {
     uint8_t str_padding = str_len % 4;
-    DEBUG_printf("str len %d padding %d\n", str_len, str_padding);
     *((uint32_t*)buffer) = htonl(str_len);
     memcpy((uint8_t*)(buffer+4), str, str_len);
     if(str_padding > 0)
     {
         str_padding = 4 - str_padding;
-        DEBUG_printf("padding %d\n", str_padding);
         memset((uint8_t*)(buffer+4+str_len), 0xff, str_padding);
     }
 
     return 4+str_padding+str_len;
 }
 
-uint decode_string(void* buffer, uint8_t* string_data)
+/*******************************************************************************************
+ * Copy an XDR string into string_data and NUL terminate it. Strings longer than
+ * max_len - 1 are truncated.
+ * *****************************************************************************************/
+uint decode_string(void* buffer, uint8_t* string_data, uint max_len)
 {
     PADDED_STRING_T* string = (PADDED_STRING_T*)buffer;
+    uint len = MIN(htonl(string->length), max_len - 1);
 
-    memcpy(string_data, &string->contents, htonl(string->length));
-    string_data[htonl(string->length)] = 0;
-    DEBUG_printf("Decoded string len=%d \"%s\"\n", htonl(string->length), string_data);
-    return htonl(string->length);
+    memcpy(string_data, &string->contents, len);
+    string_data[len] = 0;
+    LOG_DEBUG(LOG_STRING_DECODED, len);
+    return len;
 }
 
 void create_rpc_reply(TCP_RPC_REPLY_T* rpc_reply, uint32_t xid, uint32_t length)
@@ -294,8 +396,142 @@ err_t send_data_list(struct tcp_pcb *tpcb, SEND_T * data, uint length)
         err_t err = tcp_write(tpcb, data[i].ptr, data[i].length, data[i].flags);
         if (err != ERR_OK) 
         {
-            DEBUG_printf("Failed to write data %d\n", err);
+            LOG_ERROR(LOG_TCP_WRITE_FAILED, err);
+            return err;
+        }
+    }
+    return ERR_OK;
+}
+
+/*******************************************************************************************
+ * The arguments of a call come after its credentials and verifier, whose length varies
+ * with the flavor, AUTH_UNIX credentials for one. Returns NULL if the call is too short to
+ * have any.
+ * *****************************************************************************************/
+uint32_t *rpc_call_args(TCP_RPC_T *rpc_call, uint32_t len, uint *args_words)
+{
+    uint32_t *words = (uint32_t*)rpc_call;
+    uint count = len / 4;
+
+    uint32_t cred_len = htonl(words[8]);
+    if(cred_len > len)
+        return NULL;
+    uint i = 9 + (cred_len + 3) / 4;
+    if(i + 2 > count || htonl(words[i + 1]) > len)
+        return NULL;
+    i += 2 + (htonl(words[i + 1]) + 3) / 4;
+    if(i > count)
+        return NULL;
+
+    *args_words = count - i;
+    return words + i;
+}
+
+void rpc_reply_start(RPC_REPLY_T *reply, uint32_t xid)
+{
+    // the record length is filled in by rpc_reply_send()
+    create_rpc_reply((TCP_RPC_REPLY_T*)reply->data, xid, 0);
+    reply->len = sizeof(TCP_RPC_REPLY_T);
+}
+
+void rpc_reply_put(RPC_REPLY_T *reply, void const *data, uint len)
+{
+    len = MIN(len, RPC_REPLY_MAX - reply->len);
+    memcpy(reply->data + reply->len, data, len);
+    reply->len += len;
+}
+
+void rpc_reply_put_u32(RPC_REPLY_T *reply, uint32_t value)
+{
+    uint32_t net = htonl(value);
+    rpc_reply_put(reply, &net, sizeof(net));
+}
+
+/*******************************************************************************************
+ * An XDR string: its length, then the bytes zero padded to a multiple of 4
+ * *****************************************************************************************/
+void rpc_reply_put_string(RPC_REPLY_T *reply, void const *str, uint len)
+{
+    static const uint8_t fill[4] = {0,0,0,0};
+    rpc_reply_put_u32(reply, len);
+    rpc_reply_put(reply, str, len);
+    rpc_reply_put(reply, fill, (4 - (len % 4)) % 4);
+}
+
+/*******************************************************************************************
+ * Write the reply and push it out straight away. lwIP would otherwise hold it until its
+ * next timer or the end of the receive callback.
+ * *****************************************************************************************/
+err_t rpc_reply_send(struct tcp_pcb *tpcb, RPC_REPLY_T *reply)
+{
+    ((TCP_RPC_REPLY_T*)reply->data)->header = htonl(0x80000000 + reply->len - 4);
+    err_t err = tcp_write(tpcb, reply->data, reply->len, TCP_WRITE_FLAG_COPY);
+    if (err != ERR_OK)
+    {
+        LOG_ERROR(LOG_TCP_WRITE_FAILED, err);
+        return err;
+    }
+    return tcp_output(tpcb);
+}
+
+/*******************************************************************************************
+ * Queue a reply that can be larger than the send buffer. As much as fits is written now
+ * and tcp_server_sent() writes the rest as the client acknowledges it. Parts written
+ * without TCP_WRITE_FLAG_COPY are referenced, not copied, so they and any copied parts
+ * must stay valid until the reply has gone.
+ * *****************************************************************************************/
+err_t send_data_queued(SESSION_T *session, SEND_T *data, uint length)
+{
+    if(session->tx_count || length > SESSION_TX_PARTS)
+        return ERR_INPROGRESS;
+
+    memcpy(session->tx, data, length * sizeof(SEND_T));
+    for(uint i=0; i<length; i++)
+    {
+        if(!(data[i].flags & TCP_WRITE_FLAG_COPY) && capture_buffer_holds(data[i].ptr))
+            session->capture_sent = true;
+    }
+#if NET_THROUGHPUT
+    uint32_t total = 0;
+    for(uint i=0; i<length; i++)
+        total += data[i].length;
+    if(total > TCP_MSS)
+        wifi_transfer_started();
+#endif
+    session->tx_count = length;
+    session->tx_index = 0;
+    return send_queued(session);
+}
+
+err_t send_queued(SESSION_T *session)
+{
+    struct tcp_pcb *tpcb = session->pcb;
+
+    while(session->tx_index < session->tx_count)
+    {
+        SEND_T *part = &session->tx[session->tx_index];
+        uint len = MIN(part->length, MIN(tcp_sndbuf(tpcb), 0xffff));
+        if(len == 0)
+            break;
+
+        bool last = len == part->length && session->tx_index == session->tx_count - 1;
+        err_t err = tcp_write(tpcb, part->ptr, len, part->flags | (last ? 0 : TCP_WRITE_FLAG_MORE));
+        if(err == ERR_MEM)
+            break;  // segment queue full, carry on when some are acknowledged
+        if(err != ERR_OK)
+        {
+            LOG_ERROR(LOG_TCP_WRITE_FAILED, err);
+            session->tx_count = 0;
             return err;
         }
+
+        part->ptr = (uint8_t*)part->ptr + len;
+        part->length -= len;
+        if(part->length == 0)
+            session->tx_index++;
     }
+    LOG_DEBUG(LOG_TCP_QUEUED, session->tx_index, session->tx_count, tcp_sndbuf(tpcb));
+    if(session->tx_index == session->tx_count)
+        session->tx_count = 0;
+    return tcp_output(tpcb);
 }
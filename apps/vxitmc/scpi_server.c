@@ -0,0 +1,341 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pico/stdlib.h>
+
+#include "pico/cyw43_arch.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+
+#include "rpc_server.h"
+#include "scpi_server.h"
+#include "netbench.h"
+#include "log.h"
+#include "commands.h"
+
+err_t scpi_accept(void *arg, struct tcp_pcb *client_pcb, err_t err);
+err_t scpi_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
+err_t scpi_sent(void *arg, struct tcp_pcb *tpcb, u16_t len);
+err_t scpi_poll(void *arg, struct tcp_pcb *tpcb);
+void scpi_err(void *arg, err_t err);
+
+static void scpi_process(SCPI_CLIENT_T *client);
+static void scpi_close(SCPI_CLIENT_T *client);
+
+static SCPI_CLIENT_T clients[MAX_SESSIONS];
+
+/*******************************************************************************************
+ * Raw socket SCPI server. It shares the sessions, links and lock with VXI-11, each
+ * connection is one link.
+ * *****************************************************************************************/
+bool scpi_server_open(void)
+{
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        LOG_ERROR(LOG_PCB_FAILED);
+        return false;
+    }
+
+    err_t err = tcp_bind(pcb, NULL, SCPI_PORT);
+    if (err) {
+        LOG_ERROR(LOG_BIND_FAILED, SCPI_PORT);
+        return false;
+    }
+
+    struct tcp_pcb *listen_pcb = tcp_listen_with_backlog(pcb, MAX_SESSIONS);
+    if (!listen_pcb) {
+        LOG_ERROR(LOG_LISTEN_FAILED);
+        tcp_close(pcb);
+        return false;
+    }
+
+    tcp_accept(listen_pcb, scpi_accept);
+    return true;
+}
+
+err_t scpi_accept(void *arg, struct tcp_pcb *client_pcb, err_t err)
+{
+    if (err != ERR_OK || client_pcb == NULL) {
+        LOG_ERROR(LOG_ACCEPT_FAILED, err);
+        return err;
+    }
+
+    SCPI_CLIENT_T *client = NULL;
+    for(int i=0; i<MAX_SESSIONS; i++)
+    {
+        if(!clients[i].in_use)
+        {
+            client = &clients[i];
+            break;
+        }
+    }
+
+    SESSION_T *session = client ? session_open(client_pcb) : NULL;
+    LINK_T *link = session ? link_create(session, false) : NULL;
+    if (!link) {
+        LOG_WARN(LOG_SESSION_FULL);
+        if(session)
+            session_close(session);
+        tcp_abort(client_pcb);
+        return ERR_ABRT;
+    }
+    LOG_INFO(LOG_SCPI_CONNECTED, link->id);
+
+    memset(client, 0, sizeof(SCPI_CLIENT_T));
+    command_buffer_reset(&client->command);
+    client->in_use = true;
+    client->session = session;
+    client->link = link;
+
+    // replies are usually a single segment, send them without waiting for an ACK
+    tcp_nagle_disable(client_pcb);
+    tcp_arg(client_pcb, client);
+    tcp_sent(client_pcb, scpi_sent);
+    tcp_recv(client_pcb, scpi_recv);
+    tcp_poll(client_pcb, scpi_poll, POLL_TIME_S * 2);
+    tcp_err(client_pcb, scpi_err);
+
+    return ERR_OK;
+}
+
+err_t scpi_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    SCPI_CLIENT_T *client = (SCPI_CLIENT_T*)arg;
+    cyw43_arch_lwip_check();
+
+    if(p == NULL)
+    {
+        LOG_DEBUG(LOG_TCP_EOF);
+        scpi_close(client);
+        tcp_arg(tpcb, NULL);
+        tcp_recv(tpcb, NULL);
+        tcp_close(tpcb);
+        return ERR_OK;
+    }
+
+    if(client->rx)
+        pbuf_cat(client->rx, p);
+    else
+        client->rx = p;
+    scpi_process(client);
+    return ERR_OK;
+}
+
+err_t scpi_sent(void *arg, struct tcp_pcb *tpcb, u16_t len)
+{
+    SCPI_CLIENT_T *client = (SCPI_CLIENT_T*)arg;
+    LOG_DEBUG(LOG_TCP_SENT, len);
+    if(!client)
+        return ERR_OK;
+
+    netbench_sent(client->session);
+    if(client->session->tx_count)
+        send_queued(client->session);
+    // commands that arrived behind the response can run now
+    scpi_process(client);
+    return ERR_OK;
+}
+
+err_t scpi_poll(void *arg, struct tcp_pcb *tpcb)
+{
+    SCPI_CLIENT_T *client = (SCPI_CLIENT_T*)arg;
+    if(client && tpcb->state == CLOSE_WAIT)
+    {
+        scpi_close(client);
+        tcp_arg(tpcb, NULL);
+        tcp_sent(tpcb, NULL);
+        tcp_recv(tpcb, NULL);
+        tcp_poll(tpcb, NULL, POLL_TIME_S * 2);
+        tcp_err(tpcb, NULL);
+        tcp_abort(tpcb);
+        LOG_DEBUG(LOG_TCP_CLOSE_WAIT);
+        return ERR_ABRT;
+    }
+    if(client && client->session->tx_count)
+        return send_queued(client->session);
+    return ERR_OK;
+}
+
+void scpi_err(void *arg, err_t err)
+{
+    SCPI_CLIENT_T *client = (SCPI_CLIENT_T*)arg;
+    LOG_WARN(LOG_TCP_ERR, err);
+    // lwIP has already freed the pcb
+    if(client)
+    {
+        client->session->pcb = NULL;
+        scpi_close(client);
+    }
+}
+
+static void scpi_close(SCPI_CLIENT_T *client)
+{
+    if(!client->in_use)
+        return;
+    if(client->rx)
+        pbuf_free(client->rx);
+    client->rx = NULL;
+    client->session->tx_count = 0;
+    session_close(client->session);
+    client->in_use = false;
+}
+
+/*******************************************************************************************
+ * Send the link's response, a binary block gets the newline that ends every response
+ * *****************************************************************************************/
+static void scpi_send_response(SCPI_CLIENT_T *client)
+{
+    static const uint8_t newline[] = "\n";
+    LINK_T *link = client->link;
+    SESSION_T *session = client->session;
+    SEND_T send_data[3];
+    uint send_count = 0;
+
+    if(!link->response_ready)
+        return;
+    link->response_ready = false;
+
+    // the block header buffer is shared by every link, keep a copy until it has gone
+    if(link->response_header_len)
+    {
+        uint header_len = MIN(link->response_header_len, SESSION_TX_HEADER);
+        memcpy(session->tx_header, link->response_header, header_len);
+        send_data[send_count].ptr = (void*)session->tx_header;
+        send_data[send_count].length = header_len;
+        send_data[send_count].flags = TCP_WRITE_FLAG_COPY;
+        send_count++;
+    }
+    if(link->response_len)
+    {
+        send_data[send_count].ptr = (void*)link->response;
+        send_data[send_count].length = link->response_len;
+        send_data[send_count].flags = capture_buffer_holds(link->response) ? 0 : TCP_WRITE_FLAG_COPY;
+        send_count++;
+    }
+    if(link->response_header_len)
+    {
+        send_data[send_count].ptr = (void*)newline;
+        send_data[send_count].length = 1;
+        send_data[send_count].flags = 0;
+        send_count++;
+    }
+    if(send_count)
+        send_data_queued(session, send_data, send_count);
+}
+
+/*******************************************************************************************
+ * A whole command has arrived
+ * *****************************************************************************************/
+static void scpi_execute(SCPI_CLIENT_T *client)
+{
+    size_t len = command_buffer_end(&client->command);
+
+    if(client->command.discard)
+    {
+        LOG_WARN(LOG_SCPI_LINE_DROPPED, client->link->id);
+    }
+    else if(len && link_locked_out(client->link))
+    {
+        LOG_WARN(LOG_SCPI_LOCKED, client->link->id);
+    }
+    else if(len)
+    {
+        link_process_command(client->link, client->command.line, len);
+        scpi_send_response(client);
+    }
+    command_buffer_reset(&client->command);
+}
+
+/*******************************************************************************************
+ * Feed received bytes to the command parser. Stops when a command is waiting for its
+ * response to go out, so responses come back in order. Returns the bytes used.
+ * *****************************************************************************************/
+static size_t scpi_feed(SCPI_CLIENT_T *client, uint8_t const *data, size_t len)
+{
+    size_t used = 0;
+
+    while(used < len && !client->session->tx_count && !link_response_pending(client->link))
+    {
+        size_t sunk = netbench_sink(client->link, len - used);
+        if(sunk)
+        {
+            used += sunk;
+            continue;
+        }
+        if(command_buffer_uploading(&client->command))
+        {
+            used += command_buffer_upload(&client->command, data + used, len - used);
+        }
+        else
+        {
+            uint8_t c = data[used++];
+            if(c == '\n')
+            {
+                scpi_execute(client);
+                continue;
+            }
+            command_buffer_put(&client->command, c);
+            if(command_buffer_lost(&client->command))
+                break;
+        }
+
+        // the newline after a block ends an empty line
+        if(command_buffer_block_done(&client->command))
+            scpi_execute(client);
+    }
+    return used;
+}
+
+/*******************************************************************************************
+ * The client sent a block that cannot be skipped, there is no way to find the next
+ * command, so the connection is closed
+ * *****************************************************************************************/
+static void scpi_drop(SCPI_CLIENT_T *client)
+{
+    struct tcp_pcb *pcb = client->session->pcb;
+
+    LOG_WARN(LOG_SCPI_BLOCK_LOST, client->link->id);
+    scpi_close(client);
+    tcp_arg(pcb, NULL);
+    tcp_sent(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_poll(pcb, NULL, POLL_TIME_S * 2);
+    tcp_err(pcb, NULL);
+    tcp_close(pcb);
+}
+
+/*******************************************************************************************
+ * Work through the received data. The receive window is only opened for what has been
+ * used, so a client that sends faster than its commands run is held back by TCP.
+ * *****************************************************************************************/
+static void scpi_process(SCPI_CLIENT_T *client)
+{
+    while(client->in_use && client->rx)
+    {
+        struct pbuf *p = client->rx;
+        size_t used = scpi_feed(client, p->payload, p->len);
+        if(command_buffer_lost(&client->command))
+        {
+            scpi_drop(client);
+            break;
+        }
+        if(used == 0)
+            break;
+        client->rx = pbuf_free_header(p, used);
+        tcp_recved(client->session->pcb, used);
+    }
+}
+
+/*******************************************************************************************
+ * Answer blocking queries such as l:acq? once the capture has finished
+ * *****************************************************************************************/
+void scpi_task(void)
+{
+    for(int i=0; i<MAX_SESSIONS; i++)
+    {
+        SCPI_CLIENT_T *client = &clients[i];
+        if(!client->in_use || !client->link->response_ready || client->session->tx_count)
+            continue;
+        scpi_send_response(client);
+        scpi_process(client);
+    }
+}
@@ -0,0 +1,345 @@
+#include <string.h>
+#include <pico/stdlib.h>
+
+#include "lwip/tcp.h"
+#include "lwip/priv/tcp_priv.h"
+
+#include "rpc_server.h"
+#include "session.h"
+#include "netbench.h"
+#include "udp_stream.h"
+#include "wifi.h"
+#include "config.h"
+#include "commands.h"
+#include "log.h"
+
+_Static_assert(LINK_REPLY_MAX >= 2 * ENV_MAX_BUCKETS, "l:env? must fit a reply buffer");
+
+typedef struct REPLY_SLOT_T_ {
+    LINK_T *owner;
+    uint8_t data[LINK_REPLY_MAX];
+} REPLY_SLOT_T;
+
+static SESSION_T sessions[MAX_SESSIONS];
+static LINK_T links[MAX_LINKS];
+static LINK_T *lock_owner;
+static uint32_t next_link_id = 1;
+static REPLY_SLOT_T reply_slots[LINK_REPLY_SLOTS];
+// connections closed while lwIP still held capture_buf data, see session_capture_held()
+static struct tcp_pcb *closed_pcbs[MEMP_NUM_TCP_PCB];
+
+SESSION_T *session_open(struct tcp_pcb *pcb)
+{
+    for(int i=0; i<MAX_SESSIONS; i++)
+    {
+        if(!sessions[i].in_use)
+        {
+            sessions[i].in_use = true;
+            sessions[i].pcb = pcb;
+            sessions[i].tx_count = 0;
+            sessions[i].tx_index = 0;
+            sessions[i].capture_sent = false;
+            rpc_record_init(&sessions[i].record);
+            return &sessions[i];
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************************
+ * The connection has gone, drop its links and any lock they held. A pcb the caller is about
+ * to tcp_close() keeps sending what it has queued, capture_buf with it, so it is watched
+ * until that has been acknowledged.
+ * *****************************************************************************************/
+void session_close(SESSION_T *session)
+{
+    if(session->capture_sent && session->pcb)
+    {
+        session_capture_held();     // forget the pcbs that are done
+        for(int i=0; i<MEMP_NUM_TCP_PCB; i++)
+        {
+            if(!closed_pcbs[i] || closed_pcbs[i] == session->pcb)
+            {
+                closed_pcbs[i] = session->pcb;
+                break;
+            }
+        }
+    }
+
+    for(int i=0; i<MAX_LINKS; i++)
+    {
+        if(links[i].in_use && links[i].session == session)
+            link_destroy(&links[i]);
+    }
+    session->in_use = false;
+    session->pcb = NULL;
+}
+
+LINK_T *link_create(SESSION_T *session, bool monitor)
+{
+    for(int i=0; i<MAX_LINKS; i++)
+    {
+        if(!links[i].in_use)
+        {
+            LINK_T *link = &links[i];
+            memset(link, 0, sizeof(LINK_T));
+            link->in_use = true;
+            link->session = session;
+            link->monitor = monitor;
+            // ids are not reused while a client could still hold an old one
+            link->id = next_link_id++;
+            return link;
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************************
+ * A link is only valid on the connection that created it
+ * *****************************************************************************************/
+LINK_T *link_find(SESSION_T *session, uint32_t id)
+{
+    for(int i=0; i<MAX_LINKS; i++)
+    {
+        if(links[i].in_use && links[i].id == id && links[i].session == session)
+            return &links[i];
+    }
+    return NULL;
+}
+
+/*******************************************************************************************
+ * Any connection's link, for the abort channel, which is a connection of its own
+ * *****************************************************************************************/
+LINK_T *link_by_id(uint32_t id)
+{
+    for(int i=0; i<MAX_LINKS; i++)
+    {
+        if(links[i].in_use && links[i].id == id)
+            return &links[i];
+    }
+    return NULL;
+}
+
+LINK_T *link_at(uint index)
+{
+    return index < MAX_LINKS && links[index].in_use ? &links[index] : NULL;
+}
+
+void link_destroy(LINK_T *link)
+{
+    if(lock_owner == link)
+        lock_owner = NULL;
+    command_sender_cancel(link);
+    link->in_use = false;
+}
+
+/*******************************************************************************************
+ * Take the device lock. Returns false if another link holds it.
+ * *****************************************************************************************/
+bool link_lock(LINK_T *link)
+{
+    if(lock_owner && lock_owner != link)
+        return false;
+    lock_owner = link;
+    return true;
+}
+
+/*******************************************************************************************
+ * Release the device lock. Returns false if this link did not hold it.
+ * *****************************************************************************************/
+bool link_unlock(LINK_T *link)
+{
+    if(lock_owner != link)
+        return false;
+    lock_owner = NULL;
+    return true;
+}
+
+bool link_locked_out(LINK_T *link)
+{
+    return !link->monitor && lock_owner && lock_owner != link;
+}
+
+static bool response_unread(LINK_T *link)
+{
+    return link->response_ready &&
+           link->chunk_offset < link->response_header_len + link->response_len;
+}
+
+/*******************************************************************************************
+ * A reply buffer is free once its link has moved on to another response, or has read this
+ * one and the connection has written all of it
+ * *****************************************************************************************/
+static bool reply_slot_busy(REPLY_SLOT_T *slot, LINK_T *link)
+{
+    LINK_T *owner = slot->owner;
+    if(!owner || owner == link || !owner->in_use || owner->response != slot->data)
+        return false;
+    return response_unread(owner) || owner->session->tx_count;
+}
+
+static uint8_t *reply_slot_take(LINK_T *link)
+{
+    for(int i=0; i<LINK_REPLY_SLOTS; i++)
+    {
+        if(!reply_slot_busy(&reply_slots[i], link))
+        {
+            reply_slots[i].owner = link;
+            return reply_slots[i].data;
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************************
+ * Keep a response for the link that asked for it. The buffers commands build replies in
+ * are shared between links, so everything but a capture is copied. Captures are sent
+ * from capture_buf, which is not re-armed while a connection still holds it.
+ * *****************************************************************************************/
+void link_set_response(LINK_T *link, uint8_t const *header, size_t header_len, uint8_t const *data, size_t data_len)
+{
+    header_len = MIN(header_len, LINK_HEADER_MAX);
+    if(header_len)
+    {
+        memcpy(link->response_header_copy, header, header_len);
+        header = link->response_header_copy;
+    }
+    if(data_len && !capture_buffer_holds(data))
+    {
+        uint8_t *copy = data_len <= LINK_RESPONSE_MAX ? link->response_copy :
+                        data_len <= LINK_REPLY_MAX ? reply_slot_take(link) : NULL;
+        if(!copy)
+        {
+            LOG_WARN(LOG_LINK_REPLY_DROPPED, link->id, data_len);
+            header_len = 0;
+            data_len = 0;
+        }
+        else
+            memcpy(copy, data, data_len);
+        data = copy;
+    }
+    link->response_header = header;
+    link->response_header_len = header_len;
+    link->response = data;
+    link->response_len = data_len;
+    link->chunk_offset = 0;
+    link->response_ready = true;
+    boot_mark(BOOT_FIRST_RESPONSE);
+}
+
+bool command_complete(uint8_t const *data, size_t data_len)
+{
+    return command_complete_block(NULL, 0, data, data_len);
+}
+
+/*******************************************************************************************
+ * The response goes to the link whose command is running, or for a blocking query to the
+ * link that sent it
+ * *****************************************************************************************/
+bool command_complete_block(uint8_t const *header, size_t header_len, uint8_t const *data, size_t data_len)
+{
+    LINK_T *link = command_sender();
+    if(!link)
+        return false;   // the link went away while its capture ran
+
+    link_set_response(link, header, header_len, data, data_len);
+    return true;
+}
+
+/*******************************************************************************************
+ * Run a command for a link, any response it produces is kept in the link
+ * *****************************************************************************************/
+void link_process_command(LINK_T *link, uint8_t *data, size_t len)
+{
+    // commands that only make sense over the network are not passed to commands.c
+    if(netbench_command(link, data, len) || udp_stream_command(link, data, len) ||
+       wifi_command(link, data, len) || config_command(link, data, len))
+        return;
+
+    // a blocking query answers later, from analyser_task(), to the link that sent it
+    set_command_sender(link);
+    process_command(data, len);
+    set_command_sender(NULL);
+}
+
+/*******************************************************************************************
+ * True while the link waits for the response of a blocking query
+ * *****************************************************************************************/
+bool link_response_pending(LINK_T *link)
+{
+    return command_sender_waiting(link);
+}
+
+/*******************************************************************************************
+ * Forget the link's response, including one a blocking query has yet to produce
+ * *****************************************************************************************/
+void link_cancel_response(LINK_T *link)
+{
+    command_sender_cancel(link);
+    link->response_ready = false;
+    link->response_header_len = 0;
+    link->response_len = 0;
+    link->chunk_offset = 0;
+}
+
+/*******************************************************************************************
+ * True once the client has read all of the link's response and acknowledged every byte
+ * the connection sent
+ * *****************************************************************************************/
+bool link_response_sent(LINK_T *link)
+{
+    SESSION_T *session = link->session;
+    return !response_unread(link) && !session->tx_count &&
+           session->pcb && !session->pcb->unsent && !session->pcb->unacked;
+}
+
+LINK_T *link_lock_owner(void)
+{
+    return lock_owner;
+}
+
+/*******************************************************************************************
+ * True while a closed pcb has yet to send or have acknowledged what was queued on it. One
+ * that lwIP has freed is no longer in its list of active pcbs. If the memory has gone to a
+ * new connection it is waited for as well, which only delays the next capture.
+ * *****************************************************************************************/
+static bool closed_pcb_sending(struct tcp_pcb *pcb)
+{
+    for(struct tcp_pcb *active = tcp_active_pcbs; active; active = active->next)
+    {
+        if(active == pcb)
+            return active->unsent || active->unacked;
+    }
+    return false;
+}
+
+/*******************************************************************************************
+ * True while a connection, open or closed, has capture_buf data queued zero copy. lwIP
+ * frees the segments that reference it when the client acknowledges them, before the sent
+ * callback.
+ * *****************************************************************************************/
+bool session_capture_held(void)
+{
+    bool held = false;
+    for(int i=0; i<MEMP_NUM_TCP_PCB; i++)
+    {
+        if(!closed_pcbs[i])
+            continue;
+        if(closed_pcb_sending(closed_pcbs[i]))
+            held = true;
+        else
+            closed_pcbs[i] = NULL;
+    }
+    for(int i=0; i<MAX_SESSIONS; i++)
+    {
+        SESSION_T *session = &sessions[i];
+        if(!session->capture_sent)
+            continue;
+        if(session->in_use && session->pcb &&
+           (session->tx_count || session->pcb->unsent || session->pcb->unacked))
+            held = true;
+        else
+            session->capture_sent = false;
+    }
+    return held;
+}
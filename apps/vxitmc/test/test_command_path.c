@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "rpc_record.h"
+#include "command_buffer.h"
+#include "commands.h"
+
+/*******************************************************************************************
+ * Host test that the command path does not touch the heap. malloc and friends are wrapped
+ * at link time (see CMakeLists.txt) and counted while a test runs. Commands and block
+ * uploads go through the record decoder and the command buffer the way device_write
+ * data does, in pieces of every size.
+ * *****************************************************************************************/
+#define PATTERN_BYTES 4096
+#define WRITE_MAX 1024
+#define STREAM_MAX (4 * (PATTERN_BYTES + 64) + 64 * 1024)
+#define FUZZ_ROUNDS 2000
+
+#define CHECK(_COND) \
+    do { if(!(_COND)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #_COND); exit(1); } } while(0)
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static bool counting;
+static int heap_calls;
+
+void *__wrap_malloc(size_t size)
+{
+    heap_calls += counting;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    heap_calls += counting;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    heap_calls += counting;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+    heap_calls += counting;
+    __real_free(ptr);
+}
+
+/*******************************************************************************************
+ * The upload target of commands.c, which needs the SDK
+ * *****************************************************************************************/
+static uint8_t pattern_buf[PATTERN_BYTES];
+
+uint8_t *upload_target(uint8_t const *aData, size_t aLen, size_t *max_len)
+{
+    if(aLen >= 9 && !strncasecmp("l:patdata", (char*)aData, 9))
+    {
+        *max_len = sizeof(pattern_buf);
+        return pattern_buf;
+    }
+    return NULL;
+}
+
+/*******************************************************************************************
+ * What the commands ended with. A record here is a marker, the END flag, the data length
+ * and the data, as device_write carries them.
+ * *****************************************************************************************/
+typedef struct RESULT_T_ {
+    int commands;
+    int discarded;
+    char last[COMMAND_LINE_MAX];
+} RESULT_T;
+
+static RPC_RECORD_T rec;
+static COMMAND_BUFFER_T cb;
+static RESULT_T result;
+static uint8_t stream[STREAM_MAX];
+static uint8_t pattern[PATTERN_BYTES];
+
+static uint32_t get_be32(uint8_t const *data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static void put_be32(uint8_t *data, uint32_t value)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static void handler(void *arg, uint32_t *record, uint32_t len)
+{
+    uint8_t const *call = (uint8_t const*)record + 4;
+    bool end = get_be32(call);
+    uint32_t data_len = get_be32(call + 4);
+    uint8_t const *data = call + 8;
+    CHECK(data_len + 12 <= len);
+
+    for(uint32_t used = 0; used < data_len; )
+    {
+        if(command_buffer_uploading(&cb))
+            used += command_buffer_upload(&cb, data + used, data_len - used);
+        else
+            command_buffer_put(&cb, data[used++]);
+    }
+    if(!end)
+        return;
+
+    size_t line_len = command_buffer_end(&cb);
+    if(cb.discard)
+        result.discarded++;
+    else if(line_len)
+    {
+        result.commands++;
+        memcpy(result.last, cb.line, line_len + 1);
+    }
+    command_buffer_reset(&cb);
+}
+
+/*******************************************************************************************
+ * Append a command to the stream as device_writes of at most WRITE_MAX bytes, the last
+ * one with END. Returns the new stream length.
+ * *****************************************************************************************/
+static size_t add_command(size_t at, uint8_t const *data, size_t len)
+{
+    size_t offset = 0;
+    do
+    {
+        size_t n = len - offset < WRITE_MAX ? len - offset : WRITE_MAX;
+        size_t padded = (n + 3) & ~3u;
+        CHECK(at + 12 + padded <= sizeof(stream));
+        put_be32(stream + at, RPC_LAST_FRAGMENT | (uint32_t)(8 + padded));
+        put_be32(stream + at + 4, offset + n == len);
+        put_be32(stream + at + 8, n);
+        memcpy(stream + at + 12, data + offset, n);
+        memset(stream + at + 12 + n, 0, padded - n);
+        at += 12 + padded;
+        offset += n;
+    } while(offset < len);
+    return at;
+}
+
+static size_t add_text(size_t at, char const *text)
+{
+    return add_command(at, (uint8_t const*)text, strlen(text));
+}
+
+static size_t add_upload(size_t at, uint8_t const *data, size_t len)
+{
+    static uint8_t command[PATTERN_BYTES * 2 + 32];
+    size_t header_len = sprintf((char*)command, "l:patdata #6%06u", (unsigned)len);
+    CHECK(header_len + len <= sizeof(command));
+    memcpy(command + header_len, data, len);
+    return add_command(at, command, header_len + len);
+}
+
+/*******************************************************************************************
+ * Feed the stream in pieces of piece bytes, or of random sizes if piece is 0, counting
+ * the heap calls on the way
+ * *****************************************************************************************/
+static void feed(size_t len, size_t piece)
+{
+    rpc_record_init(&rec);
+    command_buffer_reset(&cb);
+    memset(&result, 0, sizeof(result));
+
+    heap_calls = 0;
+    counting = true;
+    for(size_t at = 0; at < len; )
+    {
+        size_t n = piece ? piece : (size_t)(1 + rand() % (rand() % 2 ? 7 : 3000));
+        if(n > len - at)
+            n = len - at;
+        rpc_record_feed(&rec, stream + at, n, handler, NULL);
+        at += n;
+    }
+    counting = false;
+    CHECK(heap_calls == 0);
+}
+
+static void test_wrap_counts(void)
+{
+    // the test is only worth something if a call made here would be seen
+    heap_calls = 0;
+    counting = true;
+    void *p = malloc(16);
+    free(p);
+    counting = false;
+    CHECK(heap_calls == 2);
+}
+
+static void test_commands(void)
+{
+    size_t len = add_text(0, "*idn?\n");
+    len = add_text(len, "l:capture 1000\n");
+    len = add_text(len, "*esr?\n");
+
+    feed(len, len);
+    CHECK(result.commands == 3 && !strcmp(result.last, "*esr?"));
+    feed(len, 1);
+    CHECK(result.commands == 3 && !strcmp(result.last, "*esr?"));
+}
+
+static void test_upload(void)
+{
+    for(size_t i=0; i<sizeof(pattern); i++)
+        pattern[i] = rand();
+    size_t len = add_upload(0, pattern, sizeof(pattern));
+    len = add_text(len, "*opc?\n");
+
+    memset(pattern_buf, 0, sizeof(pattern_buf));
+    feed(len, 5);
+    CHECK(result.commands == 2 && !strcmp(result.last, "*opc?"));
+    CHECK(!memcmp(pattern_buf, pattern, sizeof(pattern)));
+}
+
+static void test_refused(void)
+{
+    // a line too long and a block too large for its buffer are dropped, nothing else
+    static uint8_t large[PATTERN_BYTES + 1];
+    static char long_line[COMMAND_LINE_MAX + 16];
+    memset(long_line, 'a', sizeof(long_line) - 1);
+    size_t len = add_text(0, long_line);
+    len = add_upload(len, large, sizeof(large));
+    len = add_text(len, "*idn?\n");
+
+    feed(len, 0);
+    CHECK(result.discarded == 2);
+    CHECK(result.commands == 1 && !strcmp(result.last, "*idn?"));
+}
+
+static void test_random(void)
+{
+    for(int round=0; round<FUZZ_ROUNDS; round++)
+    {
+        size_t len = 0;
+        int count = 1 + rand() % 4;
+        for(int c=0; c<count; c++)
+        {
+            if(rand() % 2)
+                len = add_upload(len, pattern, rand() % sizeof(pattern));
+            else
+                len = add_text(len, "*idn?\n");
+        }
+        feed(len, 0);
+        CHECK(result.commands == count);
+    }
+}
+
+int main(void)
+{
+    srand(1);
+    test_wrap_counts();
+    test_commands();
+    test_upload();
+    test_refused();
+    test_random();
+    printf("command_path ok\n");
+    return 0;
+}
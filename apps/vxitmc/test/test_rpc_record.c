@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rpc_record.h"
+
+/*******************************************************************************************
+ * Host test of the ONC-RPC record marking decoder. Records are built, split into
+ * fragments, fed in pieces of every size and compared with what the handler is given.
+ * *****************************************************************************************/
+#define MAX_RECORDS 8
+#define RECORD_MAX (RPC_RECORD_WORDS * 4 - 4)
+#define STREAM_MAX (MAX_RECORDS * (RECORD_MAX + 64) * 2)
+#define FUZZ_ROUNDS 20000
+
+#define CHECK(_COND) \
+    do { if(!(_COND)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #_COND); exit(1); } } while(0)
+
+typedef struct RECEIVED_T_ {
+    int count;
+    uint32_t len[MAX_RECORDS];
+    uint8_t data[MAX_RECORDS][RPC_RECORD_WORDS * 4];
+    bool aligned;
+} RECEIVED_T;
+
+static RPC_RECORD_T rec;
+static RECEIVED_T received;
+static uint32_t stream_words[STREAM_MAX / 4 + 1];
+static uint8_t records[MAX_RECORDS][RECORD_MAX * 2];
+static uint32_t record_len[MAX_RECORDS];
+
+static void handler(void *arg, uint32_t *record, uint32_t len)
+{
+    RECEIVED_T *r = arg;
+    CHECK(r->count < MAX_RECORDS);
+    if((uintptr_t)record & 3)
+        r->aligned = false;
+    r->len[r->count] = len;
+    memcpy(r->data[r->count], record, len);
+    r->count++;
+}
+
+static void put_be32(uint8_t *data, uint32_t value)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+/*******************************************************************************************
+ * Append record r to the stream in fragments pieces, returns the new stream length
+ * *****************************************************************************************/
+static size_t add_record(uint8_t *stream, size_t at, int r, int fragments)
+{
+    uint32_t offset = 0;
+    for(int f=0; f<fragments; f++)
+    {
+        bool last = f == fragments - 1;
+        uint32_t len = last ? record_len[r] - offset : (record_len[r] - offset) / 2;
+        put_be32(stream + at, len | (last ? RPC_LAST_FRAGMENT : 0));
+        memcpy(stream + at + 4, records[r] + offset, len);
+        at += 4 + len;
+        offset += len;
+    }
+    return at;
+}
+
+static void make_record(int r, uint32_t len)
+{
+    record_len[r] = len;
+    for(uint32_t i=0; i<len; i++)
+        records[r][i] = rand();
+}
+
+/*******************************************************************************************
+ * Feed the stream in pieces of piece bytes, or of random sizes if piece is 0. Returns the
+ * number of records the decoder dropped.
+ * *****************************************************************************************/
+static uint32_t feed(uint8_t const *stream, size_t len, size_t piece)
+{
+    uint32_t discarded = 0;
+    rpc_record_init(&rec);
+    memset(&received, 0, sizeof(received));
+    received.aligned = true;
+
+    for(size_t at = 0; at < len; )
+    {
+        size_t n = piece ? piece : (size_t)(1 + rand() % (rand() % 2 ? 7 : 3000));
+        if(n > len - at)
+            n = len - at;
+        discarded += rpc_record_feed(&rec, stream + at, n, handler, &received);
+        at += n;
+    }
+    return discarded;
+}
+
+static void check_record(int index, int r)
+{
+    uint8_t const *got = received.data[index];
+    CHECK(received.len[index] == record_len[r] + 4);
+    CHECK(got[0] == 0x80 && got[1] == 0 && (uint32_t)((got[2] << 8) | got[3]) == record_len[r]);
+    CHECK(memcmp(got + 4, records[r], record_len[r]) == 0);
+}
+
+static void test_whole_record(void)
+{
+    uint8_t *stream = (uint8_t*)stream_words;
+    make_record(0, 40);
+    size_t len = add_record(stream, 0, 0, 1);
+
+    CHECK(feed(stream, len, len) == 0);
+    CHECK(received.count == 1);
+    check_record(0, 0);
+
+    // not 4 byte aligned, the decoder copies it into its own buffer
+    memmove(stream + 1, stream, len);
+    CHECK(feed(stream + 1, len, len) == 0);
+    CHECK(received.count == 1 && received.aligned);
+    check_record(0, 0);
+}
+
+static void test_byte_at_a_time(void)
+{
+    uint8_t *stream = (uint8_t*)stream_words;
+    make_record(0, 100);
+    make_record(1, 0);
+    size_t len = add_record(stream, 0, 0, 3);
+    len = add_record(stream, len, 1, 1);
+
+    CHECK(feed(stream, len, 1) == 0);
+    CHECK(received.count == 2);
+    check_record(0, 0);
+    check_record(1, 1);
+}
+
+static void test_several_in_one_piece(void)
+{
+    uint8_t *stream = (uint8_t*)stream_words;
+    size_t len = 0;
+    for(int r=0; r<4; r++)
+    {
+        make_record(r, 4 * (r + 1));
+        len = add_record(stream, len, r, 1);
+    }
+
+    CHECK(feed(stream, len, len) == 0);
+    CHECK(received.count == 4);
+    for(int r=0; r<4; r++)
+        check_record(r, r);
+}
+
+static void test_too_large(void)
+{
+    uint8_t *stream = (uint8_t*)stream_words;
+    make_record(0, RECORD_MAX + 4);
+    make_record(1, RECORD_MAX);
+    make_record(2, 12);
+    size_t len = add_record(stream, 0, 0, 2);
+    len = add_record(stream, len, 1, 1);
+    len = add_record(stream, len, 2, 1);
+
+    // the oversized record is skipped to its end, the ones after it still arrive
+    CHECK(feed(stream, len, 5) == 1);
+    CHECK(received.count == 2);
+    check_record(0, 1);
+    check_record(1, 2);
+}
+
+static void test_random(void)
+{
+    uint8_t *stream = (uint8_t*)stream_words;
+    for(int round=0; round<FUZZ_ROUNDS; round++)
+    {
+        int count = 1 + rand() % 5;
+        size_t len = 0;
+        for(int r=0; r<count; r++)
+        {
+            make_record(r, 4 * (rand() % (RPC_RECORD_WORDS + 40)));
+            len = add_record(stream, len, r, 1 + rand() % 3);
+        }
+
+        uint32_t discarded = feed(stream, len, 0);
+        int expected = 0;
+        for(int r=0; r<count; r++)
+        {
+            if(record_len[r] > RECORD_MAX)
+                continue;
+            check_record(expected++, r);
+        }
+        CHECK(received.count == expected);
+        CHECK(discarded == (uint32_t)(count - expected));
+    }
+}
+
+int main(void)
+{
+    srand(1);
+    test_whole_record();
+    test_byte_at_a_time();
+    test_several_in_one_piece();
+    test_too_large();
+    test_random();
+    printf("rpc_record ok\n");
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pico/stdlib.h>
+
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+#include "lwip/tcp.h"
+
+#include "udp_stream.h"
+#include "stream.h"
+#include "log.h"
+
+// blocks sent per pass of the loop, so commands are still answered at high sample rates
+#define UDP_STREAM_BURST 8
+
+static struct udp_pcb *stream_pcb;
+static ip_addr_t stream_addr;
+static u16_t stream_port;           // 0 while there is no destination
+static uint32_t sequence;
+static uint32_t next_block;
+static uint32_t datagrams;
+static uint32_t send_errors;
+static uint8_t status_buf[48];      // "255.255.255.255,65535,4294967295,4294967295\r\n"
+
+/*******************************************************************************************
+ * l:stream:udp <port>          - send the stream to this port of the client's address
+ * l:stream:udp <address>,<port>- or of another host, port 0 stops sending
+ * l:stream:udp?                - address,port,datagrams,send errors
+ * Streaming itself is started and stopped with l:stream as for the other transports.
+ * Returns false if the command is not one of these.
+ * *****************************************************************************************/
+bool udp_stream_command(LINK_T *link, uint8_t const *data, size_t len)
+{
+    if(len < 13 || strncasecmp("l:stream:udp", (char const*)data, 12))
+        return false;
+
+    if(data[12] == '?')
+    {
+        sprintf((char*)status_buf, "%s,%u,%lu,%lu\r\n", ipaddr_ntoa(&stream_addr), stream_port,
+                (unsigned long)datagrams, (unsigned long)send_errors);
+        link_set_response(link, NULL, 0, status_buf, strlen((char*)status_buf));
+        return true;
+    }
+
+    // the parameter follows the header after white space
+    char arg[40];
+    size_t arg_len = MIN(len - 12, sizeof(arg) - 1);
+    memcpy(arg, data + 12, arg_len);
+    arg[arg_len] = 0;
+    char *start = arg;
+    while(*start == ' ' || *start == '\t')
+        start++;
+
+    char *comma = strchr(start, ',');
+    ip_addr_t addr;
+    if(comma)
+    {
+        *comma = 0;
+        if(!ipaddr_aton(start, &addr))
+        {
+            LOG_WARN(LOG_UDP_STREAM_ADDRESS);
+            return true;
+        }
+    }
+    else
+        ip_addr_copy(addr, link->session->pcb->remote_ip);
+
+    char *port_text = comma ? comma + 1 : start;
+    char *end;
+    unsigned long port = strtoul(port_text, &end, 10);
+    if(end == port_text || port > 0xffff)
+    {
+        LOG_WARN(LOG_UDP_STREAM_PORT);
+        return true;
+    }
+
+    if(!stream_pcb)
+        stream_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    if(!stream_pcb)
+    {
+        LOG_ERROR(LOG_PCB_FAILED);
+        return true;
+    }
+    ip_addr_copy(stream_addr, addr);
+    stream_port = port;
+    datagrams = 0;
+    send_errors = 0;
+    LOG_INFO(LOG_UDP_STREAM, stream_port);
+    return true;
+}
+
+/*******************************************************************************************
+ * A datagram that cannot be sent is still numbered, so the receiver sees it as lost
+ * rather than the stream stalling
+ * *****************************************************************************************/
+static void send_datagram(uint8_t const *samples, uint32_t block, uint16_t offset, bool gap)
+{
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, sizeof(UDP_STREAM_HEADER_T) + UDP_STREAM_PAYLOAD, PBUF_RAM);
+    uint32_t number = sequence++;
+    if(!p)
+    {
+        send_errors++;
+        return;
+    }
+
+    UDP_STREAM_HEADER_T *header = (UDP_STREAM_HEADER_T*)p->payload;
+    header->magic = htonl(UDP_STREAM_MAGIC);
+    header->sequence = htonl(number);
+    header->block = htonl(block);
+    header->offset = htons(offset);
+    header->flags = htons(gap ? UDP_STREAM_FLAG_GAP : 0);
+    header->overruns = htonl(stream_overruns());
+    memcpy(header + 1, samples, UDP_STREAM_PAYLOAD);
+
+    if(udp_sendto(stream_pcb, p, &stream_addr, stream_port) == ERR_OK)
+        datagrams++;
+    else
+        send_errors++;
+    pbuf_free(p);
+}
+
+/*******************************************************************************************
+ * Send the blocks that have filled. UDP never waits for the host, so the ring only
+ * overruns if this loop cannot keep up, and the blocks lost are flagged.
+ * *****************************************************************************************/
+void udp_stream_task(void)
+{
+    if(!stream_running())
+    {
+        sequence = 0;
+        next_block = 0;
+        return;
+    }
+    if(!stream_port)
+        return;
+
+    for(int i=0; i<UDP_STREAM_BURST; i++)
+    {
+        uint8_t const *block = stream_claim_block();
+        if(!block)
+            break;
+
+        // every datagram of the block after a gap is flagged, any of them may be lost
+        uint32_t number = stream_block_number();
+        for(uint offset=0; offset<STREAM_BLOCK_BYTES; offset+=UDP_STREAM_PAYLOAD)
+            send_datagram(block + offset, number, offset, number != next_block);
+        next_block = number + 1;
+        stream_release_block();
+    }
+}
@@ -1,4 +1,7 @@
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
 #include <pico/stdlib.h>
 
 #include "lwip/pbuf.h"
@@ -7,211 +10,508 @@
 
 #include "rpc_server.h"
 #include "vxi_core_prog.h"
+#include "perf.h"
+#include "commands.h"
+#include "netbench.h"
+#include "log.h"
+
+uint32_t get_linkparams(uint32_t* buffer, uint32_t* lock_device, uint32_t* lock_timeout, bool* monitor);
+uint32_t get_device_write_params(LINK_T *link, uint32_t* buffer, uint32_t len, uint32_t *size);
+uint get_device_read(LINK_T *link, uint maxlen);
+uint32_t get_device_read_params(uint32_t* buffer, uint32_t* size);
+err_t send_create_link_reply(struct tcp_pcb *tpcb, uint32_t xid, uint32_t error, uint32_t link_id);
+err_t send_device_error(struct tcp_pcb *tpcb, uint32_t xid, uint32_t error);
+err_t send_device_write_reply(struct tcp_pcb *tpcb, uint32_t xid, uint32_t error, uint32_t size);
+err_t send_device_read_reply(LINK_T *link, uint32_t xid, uint32_t size);
+err_t send_device_read_error(struct tcp_pcb *tpcb, uint32_t xid, uint32_t error);
 
-#define MAX_READ_SIZE 2048
+uint encode_string_no_copy(const uint8_t* str, const uint str_len, PADDED_STRING_T* string);
 
-uint32_t get_linkparams(uint32_t* buffer);
-uint32_t create_link(uint32_t client_id);
-void get_destroy_link_params(uint32_t* buffer);
-int get_device_write_params(uint32_t* buffer);
-uint get_device_read(uint offset, uint maxlen);
-void get_device_read_params(uint32_t* buffer);
+#define CREATE_LINK 10
+#define DEVICE_WRITE 11
+#define DEVICE_READ 12
+#define DEVICE_CLEAR 15
+#define DEVICE_LOCK 18
+#define DEVICE_UNLOCK 19
+#define DESTROY_LINK 23
 
-bool process_command(uint8_t* aData, size_t aLen);
-uint encode_string_no_copy(const uint8_t* str, const uint str_len, PADDED_STRING_T* string);
+// DEVICE_ASYNC program, the abort channel
+#define DEVICE_ABORT 1
+
+#define VXI_ERR_PARAMETER 5
+#define VXI_ERR_NOT_SUPPORTED 8
+#define VXI_ERR_OUT_OF_RESOURCES 9
+#define VXI_ERR_INVALID_LINK 4
+#define VXI_ERR_LOCKED 11
+#define VXI_ERR_NO_LOCK 12
+#define VXI_ERR_IO_TIMEOUT 15
+#define VXI_ERR_ABORT 23
+
+#define VXI_FLAG_WAITLOCK 1
+#define VXI_FLAG_END 8
+
+#define VXI_REASON_REQCNT 1
+#define VXI_REASON_END 4
+
+/*******************************************************************************************
+ * Monitor links may only ask questions that leave the analyser alone. l:acq? is a query
+ * but arms a capture.
+ * *****************************************************************************************/
+static bool monitor_allowed(uint8_t const *cmd, size_t len)
+{
+    size_t i = 0;
+    while(i < len && cmd[i] != ' ' && cmd[i] != '\r' && cmd[i] != '\n')
+        i++;
+    if(i == 0 || cmd[i-1] != '?')
+        return false;
+    return !(i == 6 && !strncasecmp((const char*)cmd, "l:acq?", 6));
+}
 
-bool command_complete(uint8_t const *data, size_t data_len)
+/*******************************************************************************************
+ * Hold a create_link or device_lock reply until the lock is free or lock_timeout expires
+ * *****************************************************************************************/
+static void defer_lock(LINK_T *link, uint32_t xid, uint32_t procedure, uint32_t lock_timeout)
 {
-    responseBuffer = data;
-    responseBufferLen = data_len;
+    LOG_DEBUG(LOG_VXI_LOCK_DEFERRED, link->id, lock_timeout);
+    link->lock_pending = true;
+    link->lock_xid = xid;
+    link->lock_procedure = procedure;
+    link->lock_deadline = make_timeout_time_ms(lock_timeout);
 }
 
-#define CREATE_LINK 10
-#define DESTROY_LINK 23
-#define DEVICE_WRITE 11
-#define DEVICE_READ 12
+/*******************************************************************************************
+ * Back to idle: a capture the link armed is stopped, PIO and DMA with it, the response
+ * is dropped and a device_read waiting for it fails with an abort. A reply that is part
+ * way out has to finish, or the client would lose its place in the record stream.
+ * *****************************************************************************************/
+static void clear_link(LINK_T *link)
+{
+    LOG_INFO(LOG_VXI_CLEAR, link->id);
+    if(!link->monitor)
+        command_sender_stop(link);
+    command_buffer_reset(&link->write);
+    link_cancel_response(link);
+    if(link->read_pending)
+    {
+        link->read_pending = false;
+        send_device_read_error(link->session->pcb, link->read_xid, VXI_ERR_ABORT);
+    }
+}
 
-err_t decode_vxi(TCP_SERVER_T *state, struct tcp_pcb *tpcb, TCP_RPC_T* rpc_call, uint32_t* buffer)
+err_t decode_vxi(SESSION_T *session, struct tcp_pcb *tpcb, TCP_RPC_T* rpc_call, uint32_t len)
 {
-    TCP_RPC_REPLY_T rpc_reply;
     uint procedure = htonl(rpc_call->procedure);
+    uint args_words = 0;
+    uint32_t *args = rpc_call_args(rpc_call, len, &args_words);
+    uint32_t params_len = args ? args_words * 4 : 0;
+    LINK_T *link = NULL;
+
+    // every call except create_link starts with the link id
+    if(procedure != CREATE_LINK)
+    {
+        link = params_len >= 4 ? link_find(session, htonl(args[0])) : NULL;
+        if(!link)
+        {
+            LOG_WARN(LOG_VXI_INVALID_LINK, params_len >= 4 ? htonl(args[0]) : 0, procedure);
+            if(procedure == DEVICE_WRITE)
+                return send_device_write_reply(tpcb, rpc_call->xid, VXI_ERR_INVALID_LINK, 0);
+            if(procedure == DEVICE_READ)
+                return send_device_read_error(tpcb, rpc_call->xid, VXI_ERR_INVALID_LINK);
+            return send_device_error(tpcb, rpc_call->xid, VXI_ERR_INVALID_LINK);
+        }
+    }
 
     if(procedure == CREATE_LINK)
     {
-        DEBUG_printf("CREATE LINK\n");
-        SEND_T send_data[2];
-
-        uint32_t client_id = get_linkparams(buffer+11);
-        uint32_t link_id = create_link(client_id);
-        CREATE_LINK_PARAMS_REPLY_T create_reply;
-        
-        create_rpc_reply(&rpc_reply, rpc_call->xid, sizeof(TCP_RPC_REPLY_T) + sizeof(CREATE_LINK_PARAMS_REPLY_T) - 4);
-        
-        send_data[0].ptr = (void*)&rpc_reply;
-        send_data[0].length = sizeof(TCP_RPC_REPLY_T);
-        send_data[0].flags = TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE;
-
-        create_reply.error = 0;
-        create_reply.link_id  = htonl(link_id);
-        create_reply.abort_port = htonl(333);
-        create_reply.message_max_length = htonl(1024);
-
-        send_data[1].ptr = (void*)&create_reply;
-        send_data[1].length = sizeof(CREATE_LINK_PARAMS_REPLY_T);
-        send_data[1].flags = TCP_WRITE_FLAG_COPY;
-        
-        return send_data_list(tpcb, send_data, 2);
+        uint32_t lock_device;
+        uint32_t lock_timeout;
+        bool monitor;
+        if(params_len < offsetof(CREATE_LINK_PARAMS_T, device_name) + 4)
+            return send_create_link_reply(tpcb, rpc_call->xid, VXI_ERR_PARAMETER, 0);
+        get_linkparams(args, &lock_device, &lock_timeout, &monitor);
+
+        link = link_create(session, monitor);
+        if(!link)
+            return send_create_link_reply(tpcb, rpc_call->xid, VXI_ERR_OUT_OF_RESOURCES, 0);
+        // a monitor link may not upload, it only asks questions
+        link->write.read_only = monitor;
+        LOG_DEBUG(LOG_VXI_CREATE_LINK, link->id, monitor, lock_device);
+
+        if(lock_device && !monitor && !link_lock(link))
+        {
+            if(lock_timeout == 0)
+            {
+                link_destroy(link);
+                return send_create_link_reply(tpcb, rpc_call->xid, VXI_ERR_LOCKED, 0);
+            }
+            defer_lock(link, rpc_call->xid, CREATE_LINK, lock_timeout);
+            return ERR_OK;
+        }
+        return send_create_link_reply(tpcb, rpc_call->xid, 0, link->id);
     }
     else if (procedure == DESTROY_LINK)
     {
-        DEBUG_printf("DESTROY LINK\n");
-        SEND_T send_data[2];
-        get_destroy_link_params(buffer+11);
-        // uint len = destroy_link(htonl(prog),);
-        DESTROY_LINK_PARAMS_REPLY_T destroy_reply;
-
-        create_rpc_reply(&rpc_reply, rpc_call->xid, sizeof(TCP_RPC_REPLY_T) + sizeof(DESTROY_LINK_PARAMS_REPLY_T) - 4);
-
-        send_data[0].ptr = (void*)&rpc_reply;
-        send_data[0].length = sizeof(TCP_RPC_REPLY_T);
-        send_data[0].flags = TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE;
-
-        destroy_reply.error = 0;
-        send_data[1].ptr = (void*)&destroy_reply;
-        send_data[1].length = sizeof(DESTROY_LINK_PARAMS_REPLY_T);
-        send_data[1].flags = TCP_WRITE_FLAG_COPY;
-
-        return send_data_list(tpcb, send_data, 2);
+        LOG_DEBUG(LOG_VXI_DESTROY_LINK, link->id);
+        link_destroy(link);
+        return send_device_error(tpcb, rpc_call->xid, 0);
+    }
+    else if (procedure == DEVICE_LOCK)
+    {
+        DEVICE_LOCK_PARAMS_T* lock_params = (DEVICE_LOCK_PARAMS_T*)args;
+        if(link->monitor)
+            return send_device_error(tpcb, rpc_call->xid, VXI_ERR_NOT_SUPPORTED);
+        if(link_lock(link))
+            return send_device_error(tpcb, rpc_call->xid, 0);
+        if((htonl(lock_params->flags) & VXI_FLAG_WAITLOCK) && htonl(lock_params->lock_timeout) > 0)
+        {
+            defer_lock(link, rpc_call->xid, DEVICE_LOCK, htonl(lock_params->lock_timeout));
+            return ERR_OK;
+        }
+        return send_device_error(tpcb, rpc_call->xid, VXI_ERR_LOCKED);
+    }
+    else if (procedure == DEVICE_CLEAR)
+    {
+        if(link_locked_out(link))
+            return send_device_error(tpcb, rpc_call->xid, VXI_ERR_LOCKED);
+        clear_link(link);
+        return send_device_error(tpcb, rpc_call->xid, 0);
+    }
+    else if (procedure == DEVICE_UNLOCK)
+    {
+        return send_device_error(tpcb, rpc_call->xid, link_unlock(link) ? 0 : VXI_ERR_NO_LOCK);
     }
     else if (procedure == DEVICE_WRITE)
     {
-        DEBUG_printf("DEVICE WRITE\n");
-        SEND_T send_data[2];
-
-        chunk_offset = 0;
-        int written_size = get_device_write_params(buffer+11);
-        DEVICE_WRITE_PARAMS_REPLY_T device_write_reply;
-        create_rpc_reply(&rpc_reply, rpc_call->xid, sizeof(TCP_RPC_REPLY_T) + sizeof(DEVICE_WRITE_PARAMS_REPLY_T) - 4);
+        if(link_locked_out(link))
+            return send_device_write_reply(tpcb, rpc_call->xid, VXI_ERR_LOCKED, 0);
 
-        send_data[0].ptr = (void*)&rpc_reply;
-        send_data[0].length = sizeof(TCP_RPC_REPLY_T);
-        send_data[0].flags = TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE;
+        uint32_t written_size;
+        uint32_t error = get_device_write_params(link, args, params_len, &written_size);
+        return send_device_write_reply(tpcb, rpc_call->xid, error, written_size);
+    }
+    else if (procedure == DEVICE_READ)
+    {
+        if(link_locked_out(link))
+            return send_device_read_error(tpcb, rpc_call->xid, VXI_ERR_LOCKED);
 
-        device_write_reply.error = 0;
-        device_write_reply.size = htonl(written_size);
+        uint32_t size;
+        uint32_t io_timeout = get_device_read_params(args, &size);
 
-        send_data[1].ptr = (void*)&device_write_reply;
-        send_data[1].length = sizeof(DEVICE_WRITE_PARAMS_REPLY_T);
-        send_data[1].flags = TCP_WRITE_FLAG_COPY;
+        if(link_response_pending(link) || link->session->tx_count)
+        {
+            // hold the reply until the response is ready, and any reply still going out on
+            // the connection has gone, or the client's io_timeout expires
+            LOG_DEBUG(LOG_VXI_READ_DEFERRED, io_timeout);
+            link->read_pending = true;
+            link->read_xid = rpc_call->xid;
+            link->read_size = size;
+            link->read_deadline = make_timeout_time_ms(io_timeout);
+            return ERR_OK;
+        }
+        return send_device_read_reply(link, rpc_call->xid, size);
+    }
+    return ERR_OK;
+}
 
-        return send_data_list(tpcb, send_data, 2);
+/*******************************************************************************************
+ * Calls on the abort channel. device_abort names a link of another connection, usually
+ * one that is stuck waiting in device_read, and is answered whatever the lock.
+ * *****************************************************************************************/
+err_t decode_vxi_abort(struct tcp_pcb *tpcb, TCP_RPC_T* rpc_call, uint32_t len)
+{
+    uint procedure = htonl(rpc_call->procedure);
+    uint args_words = 0;
+    uint32_t *args = rpc_call_args(rpc_call, len, &args_words);
 
-    }
-    else if (procedure == DEVICE_READ)
+    if(procedure != DEVICE_ABORT)
     {
-        DEBUG_printf("DEVICE READ\n");
-        SEND_T send_data[5];
-
-        static uint8_t fill[4] = {0,0,0,0};
-        get_device_read_params(buffer+11);
-        DEVICE_READ_PARAMS_REPLY_T device_read_reply;
+        LOG_WARN(LOG_RPC_UNKNOWN, htonl(rpc_call->program), procedure);
+        return send_device_error(tpcb, rpc_call->xid, VXI_ERR_NOT_SUPPORTED);
+    }
 
-        uint reply_len = get_device_read(chunk_offset, max_read_size);
-        uint32_t string_length = htonl(reply_len);
+    LINK_T *link = args && args_words ? link_by_id(htonl(args[0])) : NULL;
+    if(!link)
+    {
+        LOG_WARN(LOG_VXI_INVALID_LINK, args && args_words ? htonl(args[0]) : 0, procedure);
+        return send_device_error(tpcb, rpc_call->xid, VXI_ERR_INVALID_LINK);
+    }
+    clear_link(link);
+    return send_device_error(tpcb, rpc_call->xid, 0);
+}
 
-        DEBUG_printf("Sending %d bytes from %d\n", reply_len, chunk_offset);
-        DEBUG_printf("responseBufferLen %d\n", responseBufferLen);
+/*******************************************************************************************
+ * Links to a device named "monitor..." are read only monitor links
+ * *****************************************************************************************/
+uint32_t get_linkparams(uint32_t* buffer, uint32_t* lock_device, uint32_t* lock_timeout, bool* monitor)
+{
+    uint8_t device_name[64];
 
-        uint fill_bytes_size = (4 - (reply_len % 4)) % 4;
-        DEBUG_printf("fill bytes %d bytes\n", fill_bytes_size);
+    CREATE_LINK_PARAMS_T* link_params = (CREATE_LINK_PARAMS_T*)buffer;
+    decode_string(&link_params->device_name, device_name, sizeof(device_name));
+    *lock_device = htonl(link_params->lock_device);
+    *lock_timeout = htonl(link_params->lock_timeout);
+    *monitor = !strncasecmp((const char*)device_name, "monitor", 7);
+    return htonl(link_params->client_id);
+}
 
-        create_rpc_reply(&rpc_reply, rpc_call->xid, sizeof(TCP_RPC_REPLY_T) + sizeof(DEVICE_READ_PARAMS_REPLY_T) + reply_len + fill_bytes_size);
+/*******************************************************************************************
+ * buffer holds params_len bytes of device_write parameters, the data string is not
+ * read past them. The data goes to the link's command buffer, a block in it straight to
+ * its upload buffer, and the command runs with the write that has END. A client splits
+ * anything longer than message_max_length over several writes. Returns a VXI error.
+ * *****************************************************************************************/
+uint32_t get_device_write_params(LINK_T *link, uint32_t* buffer, uint32_t params_len, uint32_t *size)
+{
+    DEVICE_WRITE_PARAMS_T* device_write_params = (DEVICE_WRITE_PARAMS_T*)buffer;
+    PADDED_STRING_T *string = (PADDED_STRING_T*)&device_write_params->data;
+    uint8_t const *data = (uint8_t const*)&string->contents;
+    uint32_t data_offset = offsetof(DEVICE_WRITE_PARAMS_T, data) + 4;
+    uint32_t len = MIN(htonl(string->length), params_len > data_offset ? params_len - data_offset : 0);
+    COMMAND_BUFFER_T *cb = &link->write;
+
+    LOG_DEBUG(LOG_VXI_DEVICE_WRITE, len);
+    for(uint32_t used = 0; used < len; )
+    {
+        size_t sunk = netbench_sink(link, len - used);
+        if(sunk)
+            used += sunk;
+        else if(command_buffer_uploading(cb))
+            used += command_buffer_upload(cb, data + used, len - used);
+        else
+            command_buffer_put(cb, data[used++]);
+    }
+    *size = len;
+    if(!(htonl(device_write_params->flags) & VXI_FLAG_END))
+        return 0;
+
+    uint32_t error = 0;
+    size_t line_len = command_buffer_end(cb);
+    if(link->monitor && !monitor_allowed(cb->line, line_len))
+        error = VXI_ERR_NOT_SUPPORTED;
+    else if(cb->discard)
+    {
+        LOG_WARN(LOG_VXI_WRITE_DROPPED, link->id);
+        error = VXI_ERR_PARAMETER;
+    }
+    else if(line_len)
+        link_process_command(link, cb->line, line_len);
+    command_buffer_reset(cb);
+    return error;
+}
 
-        send_data[0].ptr = (void*)&rpc_reply;
-        send_data[0].length = sizeof(TCP_RPC_REPLY_T);
-        send_data[0].flags = TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE;
+uint32_t get_device_read_params(uint32_t* buffer, uint32_t* size)
+{
+    DEVICE_READ_PARAMS_T* device_read_params = (DEVICE_READ_PARAMS_T*)buffer;
+    *size = htonl(device_read_params->size);
+    LOG_DEBUG(LOG_VXI_DEVICE_READ, htonl(device_read_params->link_id),
+                                   *size,
+                                   htonl(device_read_params->io_timeout),
+                                   htonl(device_read_params->lock_timeout));
+    return htonl(device_read_params->io_timeout);
+}
 
-        device_read_reply.error = 0;
-        device_read_reply.reason = htonl(4);
+err_t send_create_link_reply(struct tcp_pcb *tpcb, uint32_t xid, uint32_t error, uint32_t link_id)
+{
+    RPC_REPLY_T reply;
+
+    rpc_reply_start(&reply, xid);
+    rpc_reply_put_u32(&reply, error);
+    rpc_reply_put_u32(&reply, link_id);
+    rpc_reply_put_u32(&reply, VXI_ABORT_PORT);
+    rpc_reply_put_u32(&reply, VXI_MESSAGE_MAX);
+    return rpc_reply_send(tpcb, &reply);
+}
 
-        send_data[1].ptr = (void*)&device_read_reply;
-        send_data[1].length = sizeof(DEVICE_READ_PARAMS_REPLY_T);
-        send_data[1].flags = TCP_WRITE_FLAG_COPY  | TCP_WRITE_FLAG_MORE;
+/*******************************************************************************************
+ * Reply for the calls that only return a Device_Error
+ * *****************************************************************************************/
+err_t send_device_error(struct tcp_pcb *tpcb, uint32_t xid, uint32_t error)
+{
+    RPC_REPLY_T reply;
 
-        send_data[2].ptr = (void*)&(string_length);
-        send_data[2].length = sizeof(uint32_t);
-        send_data[2].flags = TCP_WRITE_FLAG_COPY  | TCP_WRITE_FLAG_MORE;
+    rpc_reply_start(&reply, xid);
+    rpc_reply_put_u32(&reply, error);
+    return rpc_reply_send(tpcb, &reply);
+}
 
-        uint flag = TCP_WRITE_FLAG_MORE;
+err_t send_device_write_reply(struct tcp_pcb *tpcb, uint32_t xid, uint32_t error, uint32_t size)
+{
+    RPC_REPLY_T reply;
 
-        if(fill_bytes_size == 0)
-            flag = 0;
+    rpc_reply_start(&reply, xid);
+    rpc_reply_put_u32(&reply, error);
+    rpc_reply_put_u32(&reply, size);
+    return rpc_reply_send(tpcb, &reply);
+}
 
-        send_data[3].ptr = (void*)(responseBuffer+chunk_offset);
-        send_data[3].length = reply_len;
-        send_data[3].flags = flag;
+/*******************************************************************************************
+ * Send up to size bytes of the response as one RPC reply. The fixed part of the reply is
+ * built in the session and the data is referenced where it lies, so a whole capture goes
+ * out of capture_buf in a single reply as fast as the send window allows.
+ * *****************************************************************************************/
+err_t send_device_read_reply(LINK_T *link, uint32_t xid, uint32_t size)
+{
+    SESSION_T *session = link->session;
+    SEND_T send_data[SESSION_TX_PARTS];
+    uint send_count = 1;
+
+    // tx_header belongs to the reply still going out, this one has to wait for it
+    if(session->tx_count)
+        return ERR_INPROGRESS;
+
+    static uint8_t fill[4] = {0,0,0,0};
+    TCP_RPC_REPLY_T *rpc_reply = (TCP_RPC_REPLY_T*)session->tx_header;
+    DEVICE_READ_PARAMS_REPLY_T *device_read_reply = (DEVICE_READ_PARAMS_REPLY_T*)(rpc_reply + 1);
+    uint32_t *string_length = (uint32_t*)(device_read_reply + 1);
+    uint8_t *header_copy = (uint8_t*)(string_length + 1);
+
+    uint reply_len = get_device_read(link, size);
+    uint fill_bytes_size = (4 - (reply_len % 4)) % 4;
+    uint total = link->response_header_len + link->response_len;
+    LOG_DEBUG(LOG_VXI_READ_REPLY, reply_len, link->chunk_offset, total, fill_bytes_size);
+
+    create_rpc_reply(rpc_reply, xid, sizeof(TCP_RPC_REPLY_T) + sizeof(DEVICE_READ_PARAMS_REPLY_T) + reply_len + fill_bytes_size);
+    device_read_reply->error = 0;
+    // END only goes with the last of the response, the client reads again until it sees it
+    device_read_reply->reason = htonl(link->chunk_offset + reply_len == total ? VXI_REASON_END : VXI_REASON_REQCNT);
+    *string_length = htonl(reply_len);
+
+    // the response is the block header (if any) followed by the data
+    uint offset = link->chunk_offset;
+    uint len = reply_len;
+    uint header_part = 0;
+    if(offset < link->response_header_len && len > 0)
+    {
+        header_part = MIN(len, link->response_header_len - offset);
+        header_part = MIN(header_part, session->tx_header + SESSION_TX_HEADER - header_copy);
+        memcpy(header_copy, link->response_header+offset, header_part);
+        offset += header_part;
+        len -= header_part;
+    }
+    uint8_t *tx_end = header_copy + header_part;
+    uint8_t const *data = link->response + offset - link->response_header_len;
 
-        chunk_offset+=reply_len;
+    // a short reply such as *idn? goes in the same buffer as its header, one write and
+    // one segment
+    if(len > 0 && len + fill_bytes_size <= (uint)(session->tx_header + SESSION_TX_HEADER - tx_end))
+    {
+        memcpy(tx_end, data, len);
+        memset(tx_end + len, 0, fill_bytes_size);
+        tx_end += len + fill_bytes_size;
+        len = 0;
+        fill_bytes_size = 0;
+    }
+    send_data[0].ptr = (void*)session->tx_header;
+    send_data[0].length = tx_end - session->tx_header;
+    send_data[0].flags = TCP_WRITE_FLAG_COPY;
 
-        if(fill_bytes_size != 0)
-        {
-            DEBUG_printf("sending fill bytes %d bytes\n", fill_bytes_size);
-            send_data[4].ptr = (void*)&fill;
-            send_data[4].length = fill_bytes_size;
-            send_data[4].flags = TCP_WRITE_FLAG_COPY;
+    if(len > 0)
+    {
+        // captures are referenced in capture_buf, anything else is copied by lwIP
+        send_data[send_count].ptr = (void*)data;
+        send_data[send_count].length = len;
+        send_data[send_count].flags = capture_buffer_holds(link->response) ? 0 : TCP_WRITE_FLAG_COPY;
+        send_count++;
+    }
 
-            return send_data_list(tpcb, send_data, 5);
-        }
-        else
-            return send_data_list(tpcb, send_data, 4);
+    if(fill_bytes_size != 0)
+    {
+        send_data[send_count].ptr = (void*)&fill;
+        send_data[send_count].length = fill_bytes_size;
+        send_data[send_count].flags = 0;
+        send_count++;
     }
+
+    if(link->chunk_offset == 0)
+        perf_mark(PERF_TX_FIRST);
+    err_t err = send_data_queued(session, send_data, send_count);
+    // the next device_read carries on after this chunk only if it went out
+    if(err != ERR_OK)
+        return err;
+    link->chunk_offset+=reply_len;
+    if(link->chunk_offset == total)
+        perf_mark(PERF_TX_LAST);
     return ERR_OK;
 }
 
-uint32_t get_linkparams(uint32_t* buffer)
+err_t send_device_read_error(struct tcp_pcb *tpcb, uint32_t xid, uint32_t error)
 {
-    uint8_t device_name[64];
+    RPC_REPLY_T reply;
 
-    CREATE_LINK_PARAMS_T* link_params = (CREATE_LINK_PARAMS_T*)buffer;
-    link_params->client_id = link_params->client_id;
-    decode_string(&link_params->device_name, device_name);
-    return link_params->client_id;
+    rpc_reply_start(&reply, xid);
+    rpc_reply_put_u32(&reply, error);
+    rpc_reply_put_u32(&reply, 0);       // reason
+    rpc_reply_put_u32(&reply, 0);       // no data
+    return rpc_reply_send(tpcb, &reply);
 }
 
-uint32_t create_link(uint32_t client_id)
+/*******************************************************************************************
+ * Complete a deferred device_read once the response is ready or the io_timeout expires
+ * *****************************************************************************************/
+static void complete_pending_read(LINK_T *link)
 {
-    return 5678;
-}
+    struct tcp_pcb *tpcb = link->session->pcb;
 
-void get_destroy_link_params(uint32_t* buffer)
-{
-    DESTROY_LINK_PARAMS_T* link_params = (DESTROY_LINK_PARAMS_T*)buffer;
-    link_params->link_id = htonl(link_params->link_id);
+    // replies are not interleaved, another link's reply on the connection finishes first
+    if(link->session->tx_count)
+        return;
+
+    if(!link_response_pending(link))
+    {
+        send_device_read_reply(link, link->read_xid, link->read_size);
+    }
+    else if(time_reached(link->read_deadline))
+    {
+        LOG_WARN(LOG_VXI_READ_TIMEOUT);
+        send_device_read_error(tpcb, link->read_xid, VXI_ERR_IO_TIMEOUT);
+    }
+    else
+        return;
+
+    link->read_pending = false;
 }
 
-int get_device_write_params(uint32_t* buffer)
+/*******************************************************************************************
+ * Complete a deferred create_link or device_lock once the lock is free, or fail it when
+ * lock_timeout expires
+ * *****************************************************************************************/
+static void complete_pending_lock(LINK_T *link)
 {
-    uint8_t* write_data = (uint8_t*) malloc(128);
-    DEVICE_WRITE_PARAMS_T* device_write_params = (DEVICE_WRITE_PARAMS_T*)buffer;
-    size_t len = decode_string(&device_write_params->data, write_data);
-    bool pc = process_command(write_data, len);
-    free(write_data);
-    DEBUG_printf("process_command %d\n", pc);
-    return len;
+    struct tcp_pcb *tpcb = link->session->pcb;
+    uint32_t error;
+
+    if(link_lock(link))
+        error = 0;
+    else if(time_reached(link->lock_deadline))
+        error = VXI_ERR_LOCKED;
+    else
+        return;
+
+    link->lock_pending = false;
+    if(link->lock_procedure == CREATE_LINK)
+    {
+        send_create_link_reply(tpcb, link->lock_xid, error, error ? 0 : link->id);
+        if(error)
+            link_destroy(link);
+    }
+    else
+        send_device_error(tpcb, link->lock_xid, error);
 }
 
-void get_device_read_params(uint32_t* buffer)
+void vxi_task()
 {
-    DEVICE_READ_PARAMS_T* device_read_params = (DEVICE_READ_PARAMS_T*)buffer;
-    max_read_size = MAX_READ_SIZE;
-    DEBUG_printf("Read device %d size %d io timeout %d lock timeout %d\n", htonl(device_read_params->link_id), 
-                                                                            max_read_size, 
-                                                                            htonl(device_read_params->io_timeout),
-                                                                            htonl(device_read_params->lock_timeout));
+    for(uint i=0; i<MAX_LINKS; i++)
+    {
+        LINK_T *link = link_at(i);
+        if(link && link->read_pending)
+            complete_pending_read(link);
+        if(link && link->lock_pending)
+            complete_pending_lock(link);
+    }
 }
 
-uint get_device_read(uint offset, uint maxlen)
+uint get_device_read(LINK_T *link, uint maxlen)
 {
-    uint buffer_left = responseBufferLen - offset;
+    uint buffer_left = link->response_header_len + link->response_len - link->chunk_offset;
     return MIN(maxlen, buffer_left);
 }
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pico/stdlib.h>
+#include "pico/cyw43_arch.h"
+
+#include "lwip/netif.h"
+#include "lwip/dhcp.h"
+#include "lwip/ip_addr.h"
+
+#include "wifi.h"
+#include "config.h"
+#include "log.h"
+
+#define CYW43_IOCTL_GET_CHANNEL 0x3a    // WLC_GET_CHANNEL << 1
+
+static WIFI_CACHE_T cache;
+static bool cache_valid;
+static bool fast_join;
+static uint64_t boot_us[BOOT_EVENT_COUNT];
+static uint8_t boot_buf[48];        // "4294967295,4294967295,4294967295,1\r\n"
+
+static uint16_t cache_crc(WIFI_CACHE_T const *c)
+{
+    return config_crc16((uint8_t const *)c, offsetof(WIFI_CACHE_T, crc));
+}
+
+/*******************************************************************************************
+ * Take the cache from the config store. A cache without the magic and a good CRC, like
+ * the bytes of an EEPROM that only ever held credentials, is no cache.
+ * *****************************************************************************************/
+void wifi_load_cache(void)
+{
+    cache_valid = config_get(CONFIG_WIFI, &cache, sizeof(cache)) == sizeof(cache) &&
+                  cache.magic == WIFI_CACHE_MAGIC && cache.crc == cache_crc(&cache);
+    if(!cache_valid)
+        memset(&cache, 0, sizeof(cache));
+}
+
+static void save_cache(void)
+{
+    cache.magic = WIFI_CACHE_MAGIC;
+    cache.crc = cache_crc(&cache);
+    cache_valid = true;
+    config_set(CONFIG_WIFI, &cache, sizeof(cache));
+}
+
+static uint8_t current_channel(void)
+{
+    uint32_t info[3] = {0};     // channel_info_t, hw_channel first
+    if(cyw43_ioctl(&cyw43_state, CYW43_IOCTL_GET_CHANNEL, sizeof(info), (uint8_t *)info, CYW43_ITF_STA))
+        return 0;
+    return (uint8_t)info[0];
+}
+
+/*******************************************************************************************
+ * Wait for the link to come up with an address. With an address already set this is as
+ * soon as the access point has let us in.
+ * *****************************************************************************************/
+static bool wait_for_link(uint32_t timeout_ms)
+{
+    absolute_time_t until = make_timeout_time_ms(timeout_ms);
+    while(!time_reached(until))
+    {
+        int status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+        if(status == CYW43_LINK_UP)
+            return true;
+        if(status == CYW43_LINK_FAIL || status == CYW43_LINK_BADAUTH)
+            return false;
+        cyw43_arch_poll();
+        cyw43_arch_wait_for_work_until(until);
+    }
+    return false;
+}
+
+/*******************************************************************************************
+ * Set the address before joining so the link is up without waiting for DHCP. A cached
+ * lease leaves DHCP running, it confirms the address or moves us to a new one.
+ * *****************************************************************************************/
+static void set_address(uint32_t ip, uint32_t netmask, uint32_t gateway)
+{
+    ip4_addr_t addr, mask, gw;
+    ip4_addr_set_u32(&addr, ip);
+    ip4_addr_set_u32(&mask, netmask);
+    ip4_addr_set_u32(&gw, gateway);
+    netif_set_addr(netif_default, &addr, &mask, &gw);
+}
+
+/*******************************************************************************************
+ * Join the network, first straight to the access point and channel of the last join and
+ * with its address, then, if that fails, with a full scan and DHCP. What worked is saved
+ * when it differs from the cache.
+ * *****************************************************************************************/
+int wifi_connect(const char *ssid, const char *pwd)
+{
+    uint16_t ssid_check = config_crc16((uint8_t const *)ssid, strlen(ssid));
+    bool use_cache = cache_valid && cache.ssid_check == ssid_check;
+    bool static_ip = use_cache && (cache.flags & WIFI_CACHE_STATIC);
+    int err = PICO_ERROR_TIMEOUT;
+
+    if(static_ip)
+        dhcp_stop(netif_default);
+    if(use_cache && cache.ip)
+        set_address(cache.ip, cache.netmask, cache.gateway);
+
+    if(use_cache && cache.channel)
+    {
+        cyw43_arch_lwip_begin();
+        err = cyw43_wifi_join(&cyw43_state, strlen(ssid), (uint8_t const *)ssid, strlen(pwd), (uint8_t const *)pwd,
+                              CYW43_AUTH_WPA2_AES_PSK, cache.bssid, cache.channel);
+        cyw43_arch_lwip_end();
+        fast_join = !err && wait_for_link(WIFI_FAST_JOIN_MS);
+    }
+
+    if(!fast_join)
+    {
+        if(use_cache && cache.channel)
+        {
+            printf("Cached access point not found, scanning\n");
+            cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+        }
+        // the cached address may belong to another network
+        if(!static_ip)
+            set_address(0, 0, 0);
+        err = cyw43_arch_wifi_connect_timeout_ms(ssid, pwd, CYW43_AUTH_WPA2_AES_PSK, WIFI_JOIN_MS);
+        if(err)
+            return err;
+    }
+    boot_mark(BOOT_LINK_UP);
+
+    WIFI_CACHE_T seen = cache;
+    if(!use_cache)
+        memset(&seen, 0, sizeof(seen));
+    seen.ssid_check = ssid_check;
+    cyw43_wifi_get_bssid(&cyw43_state, seen.bssid);
+    seen.channel = current_channel();
+    if(!static_ip)
+    {
+        seen.ip = ip4_addr_get_u32(netif_ip4_addr(netif_default));
+        seen.netmask = ip4_addr_get_u32(netif_ip4_netmask(netif_default));
+        seen.gateway = ip4_addr_get_u32(netif_ip4_gw(netif_default));
+    }
+    if(!use_cache || memcmp(&seen, &cache, offsetof(WIFI_CACHE_T, crc)))
+    {
+        cache = seen;
+        save_cache();
+    }
+    printf("Connected to channel %d, %s%s\n", seen.channel, ip4addr_ntoa(netif_ip4_addr(netif_default)),
+           fast_join ? " (fast)" : "");
+    return 0;
+}
+
+/*******************************************************************************************
+ * Note when the unit got to a step of coming up, only the first time
+ * *****************************************************************************************/
+void boot_mark(BOOT_EVENT_T event)
+{
+    if(boot_us[event])
+        return;
+    boot_us[event] = time_us_64();
+    if(event == BOOT_LISTENING)
+        printf("Link up after %lu ms, listening after %lu ms\n", (unsigned long)(boot_us[BOOT_LINK_UP] / 1000),
+               (unsigned long)(boot_us[BOOT_LISTENING] / 1000));
+}
+
+static bool set_static(char const *arg)
+{
+    ip4_addr_t addr, mask, gw;
+    char buf[48];
+    strncpy(buf, arg, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+
+    char *mask_str = strchr(buf, ',');
+    char *gw_str = mask_str ? strchr(mask_str + 1, ',') : NULL;
+    if(!gw_str)
+        return false;
+    *mask_str++ = 0;
+    *gw_str++ = 0;
+    if(!ip4addr_aton(buf, &addr) || !ip4addr_aton(mask_str, &mask) || !ip4addr_aton(gw_str, &gw))
+        return false;
+
+    cache.ip = ip4_addr_get_u32(&addr);
+    cache.netmask = ip4_addr_get_u32(&mask);
+    cache.gateway = ip4_addr_get_u32(&gw);
+    cache.flags |= WIFI_CACHE_STATIC;
+    return true;
+}
+
+/*******************************************************************************************
+ * syst:net:boot?               - ms from boot to the link up, the servers listening and
+ *                                the first response, and 1 if the cached join worked
+ * syst:net:static <ip>,<mask>,<gw> - use this address from the next boot on, without DHCP
+ * syst:net:static 0            - back to DHCP from the next boot on
+ * Returns false if the command is not one of these.
+ * *****************************************************************************************/
+bool wifi_command(LINK_T *link, uint8_t const *data, size_t len)
+{
+    if(len >= 14 && !strncasecmp("syst:net:boot?", (char const*)data, 14))
+    {
+        boot_mark(BOOT_FIRST_RESPONSE);
+        sprintf((char*)boot_buf, "%lu,%lu,%lu,%d\r\n", (unsigned long)(boot_us[BOOT_LINK_UP] / 1000),
+                (unsigned long)(boot_us[BOOT_LISTENING] / 1000), (unsigned long)(boot_us[BOOT_FIRST_RESPONSE] / 1000),
+                fast_join);
+        link_set_response(link, NULL, 0, boot_buf, strlen((char*)boot_buf));
+        return true;
+    }
+    if(len >= 16 && !strncasecmp("syst:net:static", (char const*)data, 15) && data[15] == ' ')
+    {
+        char arg[48];
+        size_t arg_len = MIN(len - 16, sizeof(arg) - 1);
+        memcpy(arg, data + 16, arg_len);
+        arg[arg_len] = 0;
+
+        if(atoi(arg) == 0 && !strchr(arg, '.'))
+        {
+            cache.flags &= ~WIFI_CACHE_STATIC;
+            cache.ip = 0;
+        }
+        else if(!set_static(arg))
+        {
+            LOG_WARN(LOG_WIFI_STATIC);
+            return true;
+        }
+        save_cache();
+        return true;
+    }
+    return false;
+}
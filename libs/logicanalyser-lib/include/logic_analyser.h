@@ -3,9 +3,44 @@
 #include "hardware/pio.h"
 #include "hardware/irq.h"
 
+#define LOGIC_ANALYSER_MAX 4
 
-void logic_analyser_init(PIO pio, uint sm, uint pin_base, uint pin_count, uint trigger_pin, uint trigger_type, float div);
-void logic_analyser_arm(PIO pio, uint sm, uint dma_chan, uint32_t *capture_buf, size_t capture_size_words, irq_handler_t dma_handler);
+typedef struct LOGIC_ANALYSER_T_ LOGIC_ANALYSER_T;
+typedef void (*logic_analyser_complete_t)(LOGIC_ANALYSER_T *analyser);
+
+/*******************************************************************************************
+ * One capture engine: a PIO state machine, the DMA channel draining it and the capture
+ * program loaded for it. Several can run at once on different state machines.
+ * *****************************************************************************************/
+struct LOGIC_ANALYSER_T_ {
+    PIO pio;
+    uint sm;
+    uint dma_chan;
+    uint pin_base;
+    uint pin_count;
+    uint offset;
+    struct pio_program *current_program;
+    uint16_t program_instructions[32];
+    struct pio_program pio_program;
+    logic_analyser_complete_t complete;
+    void *user_data;
+
+    // continuous capture into a ring of blocks, stream_chan < 0 when not streaming
+    int stream_chan;
+    uint32_t *ring;
+    size_t block_words;
+    uint block_count;
+    volatile uint32_t blocks_written;
+    logic_analyser_complete_t block_complete;
+};
+
+void logic_analyser_create(LOGIC_ANALYSER_T *analyser, PIO pio, uint sm, uint dma_chan, uint pin_base, uint pin_count, logic_analyser_complete_t complete, void *user_data);
+void logic_analyser_init(LOGIC_ANALYSER_T *analyser, uint trigger_pin, uint trigger_type, float div);
+void logic_analyser_arm(LOGIC_ANALYSER_T *analyser, uint32_t *capture_buf, size_t capture_size_words);
+uint32_t logic_analyser_words_left(LOGIC_ANALYSER_T *analyser);
+void logic_analyser_stream(LOGIC_ANALYSER_T *analyser, uint stream_chan, uint32_t *ring, size_t block_words, uint block_count, logic_analyser_complete_t block_complete);
+void logic_analyser_stop(LOGIC_ANALYSER_T *analyser);
 void generate_pattern(PIO pio, uint sm, uint pattern, uint pin_base, uint dma_channel, float div);
+void generator_set_user_pattern(uint32_t const *pattern, size_t words);
 
 #endif
\ No newline at end of file
@@ -32,14 +32,89 @@
 #include "hardware/dma.h"
 #include "hardware/irq.h"
 #include "hardware/clocks.h"
+#include "logic_analyser.h"
 
 
-uint compile_capture(PIO pio, pio_sm_config *c, uint pin_count, uint trigger_pin, uint trigger_type, float div);
+uint compile_capture(LOGIC_ANALYSER_T *analyser, pio_sm_config *c, uint trigger_pin, uint trigger_type, float div);
 
-uint offset;
-struct pio_program *current_program=NULL;
-uint16_t program_instructions[32];
-struct pio_program pio_program;
+static LOGIC_ANALYSER_T *analysers[LOGIC_ANALYSER_MAX];
+
+/*******************************************************************************************
+ * A streaming analyser ping-pongs between its two DMA channels, block n is written by
+ * dma_chan when n is even and by stream_chan when it is odd. Each channel that finished
+ * is pointed two blocks further on before the other channel chains back to it. Blocks
+ * are handled in order even if both channels finished before the IRQ was serviced.
+ * *****************************************************************************************/
+static void logic_analyser_stream_irq(LOGIC_ANALYSER_T *analyser)
+{
+    for(;;)
+    {
+        uint chan = (analyser->blocks_written & 1) ? analyser->stream_chan : analyser->dma_chan;
+        if(!dma_channel_get_irq0_status(chan))
+            break;
+        dma_channel_acknowledge_irq0(chan);
+
+        uint next = (analyser->blocks_written + 2) % analyser->block_count;
+        dma_channel_set_write_addr(chan, analyser->ring + next * analyser->block_words, false);
+        analyser->blocks_written++;
+
+        if(analyser->block_complete)
+            analyser->block_complete(analyser);
+    }
+}
+
+/*******************************************************************************************
+ * DMA IRQ 0 is shared by all the analysers. Find the channel(s) that finished and tell
+ * their owners.
+ * *****************************************************************************************/
+static void logic_analyser_dma_irq()
+{
+    for(int i=0; i<LOGIC_ANALYSER_MAX; i++)
+    {
+        LOGIC_ANALYSER_T *analyser = analysers[i];
+        if(analyser && analyser->stream_chan >= 0)
+        {
+            logic_analyser_stream_irq(analyser);
+        }
+        else if(analyser && dma_channel_get_irq0_status(analyser->dma_chan))
+        {
+            dma_channel_acknowledge_irq0(analyser->dma_chan);
+            if(analyser->complete)
+                analyser->complete(analyser);
+        }
+    }
+}
+
+/*******************************************************************************************
+ * Set up an analyser context on a PIO state machine and DMA channel
+ * 
+ * The caller owns the state machine and DMA channel. complete is called from the DMA
+ * interrupt when a capture has finished.
+ * *****************************************************************************************/
+void logic_analyser_create(LOGIC_ANALYSER_T *analyser, PIO pio, uint sm, uint dma_chan, uint pin_base, uint pin_count, logic_analyser_complete_t complete, void *user_data)
+{
+    memset(analyser, 0, sizeof(LOGIC_ANALYSER_T));
+    analyser->pio = pio;
+    analyser->sm = sm;
+    analyser->dma_chan = dma_chan;
+    analyser->pin_base = pin_base;
+    analyser->pin_count = pin_count;
+    analyser->complete = complete;
+    analyser->user_data = user_data;
+    analyser->stream_chan = -1;
+
+    for(int i=0; i<LOGIC_ANALYSER_MAX; i++)
+    {
+        if(!analysers[i])
+        {
+            analysers[i] = analyser;
+            break;
+        }
+    }
+
+    irq_set_exclusive_handler(DMA_IRQ_0, logic_analyser_dma_irq);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
 
 /*******************************************************************************************
  * Initialise the logic analyser program
@@ -51,25 +126,25 @@ struct pio_program pio_program;
  * The programs support triggering be level and edge on one GPIO pin
  * 
  * *****************************************************************************************/
-void logic_analyser_init(PIO pio, uint sm, uint pin_base, uint pin_count, uint trigger_pin, uint trigger_type, float div) 
+void logic_analyser_init(LOGIC_ANALYSER_T *analyser, uint trigger_pin, uint trigger_type, float div) 
 {
     pio_sm_config c = pio_get_default_sm_config();
     // remove any current PIO proram from the statemachine
-    if(current_program)
-        pio_remove_program(pio, current_program, offset);
+    if(analyser->current_program)
+        pio_remove_program(analyser->pio, analyser->current_program, analyser->offset);
 
     // compile and load PIO capture program
-    offset = compile_capture(pio, &c, pin_count, trigger_pin, trigger_type, div);
+    analyser->offset = compile_capture(analyser, &c, trigger_pin, trigger_type, div);
 
     // configure statemachine IN pins
-    sm_config_set_in_pins(&c, pin_base);
+    sm_config_set_in_pins(&c, analyser->pin_base);
     
     // configure fifos
     sm_config_set_in_shift(&c, true, true, 32);
     sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
 
     // initialise the statemachine so that it's ready to run
-    pio_sm_init(pio, sm, offset, &c);
+    pio_sm_init(analyser->pio, analyser->sm, analyser->offset, &c);
 }
 
 /*******************************************************************************************
@@ -80,12 +155,19 @@ void logic_analyser_init(PIO pio, uint sm, uint pin_base, uint pin_count, uint t
  * then it will stall until the condition is met.
  * 
  * *****************************************************************************************/
-void logic_analyser_arm(PIO pio, uint sm, uint dma_chan, uint32_t *capture_buf, size_t capture_size_words, irq_handler_t dma_handler) 
+void logic_analyser_arm(LOGIC_ANALYSER_T *analyser, uint32_t *capture_buf, size_t capture_size_words) 
 {
+    PIO pio = analyser->pio;
+    uint sm = analyser->sm;
+    uint dma_chan = analyser->dma_chan;
+
     // stop the statemachine and clear down fifos.
     pio_sm_set_enabled(pio, sm, false);
     pio_sm_clear_fifos(pio, sm);
 
+    // a capture may still be running, stop it without raising its completion IRQ
+    logic_analyser_stop(analyser);
+
     // configure the DMA so that it reads data from the statemachine
     // the data rate is controlled by the statemachine DREQ
     dma_channel_config c = dma_channel_get_default_config(dma_chan);
@@ -96,8 +178,6 @@ void logic_analyser_arm(PIO pio, uint sm, uint dma_chan, uint32_t *capture_buf,
 
     // generate an IRQ and the end of the capture
     dma_channel_set_irq0_enabled(dma_chan, true);
-    irq_set_exclusive_handler(DMA_IRQ_0, dma_handler);
-    irq_set_enabled(DMA_IRQ_0, true);
 
     // configure a one shot DMA request.
     dma_channel_configure(dma_chan, &c,
@@ -111,6 +191,81 @@ void logic_analyser_arm(PIO pio, uint sm, uint dma_chan, uint32_t *capture_buf,
     pio_sm_set_enabled(pio, sm, true);
 }
 
+/*******************************************************************************************
+ * Words the DMA still has to write for the current capture
+ * *****************************************************************************************/
+uint32_t logic_analyser_words_left(LOGIC_ANALYSER_T *analyser)
+{
+    return dma_channel_hw_addr(analyser->dma_chan)->transfer_count;
+}
+
+static void stop_channel(uint chan)
+{
+    dma_channel_set_irq0_enabled(chan, false);
+    dma_channel_abort(chan);
+    dma_channel_acknowledge_irq0(chan);
+}
+
+/*******************************************************************************************
+ * Stop the state machine and any capture or stream, without raising completion IRQs
+ * *****************************************************************************************/
+void logic_analyser_stop(LOGIC_ANALYSER_T *analyser)
+{
+    pio_sm_set_enabled(analyser->pio, analyser->sm, false);
+    stop_channel(analyser->dma_chan);
+    if(analyser->stream_chan >= 0)
+    {
+        stop_channel(analyser->stream_chan);
+        analyser->stream_chan = -1;
+    }
+}
+
+/*******************************************************************************************
+ * Capture continuously into a ring of block_count blocks of block_words each. Two DMA
+ * channels chained to each other take turns, so the capture never stops while a block is
+ * re-armed. block_complete is called from the DMA interrupt after every block and
+ * blocks_written counts them. block_count must be even and at least 4; the two blocks
+ * after the last one written are owned by the DMA.
+ * *****************************************************************************************/
+void logic_analyser_stream(LOGIC_ANALYSER_T *analyser, uint stream_chan, uint32_t *ring, size_t block_words, uint block_count, logic_analyser_complete_t block_complete)
+{
+    PIO pio = analyser->pio;
+    uint sm = analyser->sm;
+    uint chans[2] = { analyser->dma_chan, stream_chan };
+
+    logic_analyser_stop(analyser);
+    pio_sm_clear_fifos(pio, sm);
+
+    analyser->ring = ring;
+    analyser->block_words = block_words;
+    analyser->block_count = block_count;
+    analyser->blocks_written = 0;
+    analyser->block_complete = block_complete;
+
+    for(int i=0; i<2; i++)
+    {
+        dma_channel_config c = dma_channel_get_default_config(chans[i]);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false));
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_chain_to(&c, chans[1 - i]);
+
+        dma_channel_configure(chans[i], &c,
+            ring + i * block_words, // Destinatinon pointer
+            &pio->rxf[sm],          // Source pointer
+            block_words,            // Number of transfers
+            false                   // Started by the first channel or by the chain
+        );
+        dma_channel_acknowledge_irq0(chans[i]);
+        dma_channel_set_irq0_enabled(chans[i], true);
+    }
+    analyser->stream_chan = stream_chan;
+
+    dma_channel_start(chans[0]);
+    pio_sm_set_enabled(pio, sm, true);
+}
+
 uint8_t add_level_trigger(bool level, uint trigger_pin, uint16_t* program, uint8_t prog_offset)
 {
     program[prog_offset] = pio_encode_wait_gpio(level, trigger_pin);
@@ -134,8 +289,10 @@ uint8_t add_edge_trigger(bool edge, uint trigger_pin, uint16_t* program, uint8_t
 }
 
 
-uint compile_slow_capture(PIO pio, uint pin_count, uint trigger_pin, uint trigger_type)
+uint compile_slow_capture(LOGIC_ANALYSER_T *analyser, uint trigger_pin, uint trigger_type)
 {
+    uint16_t *program_instructions = analyser->program_instructions;
+    uint pin_count = analyser->pin_count;
     uint8_t prog_offset = 0;
     if(trigger_type == 1 || trigger_type == 2)
 
@@ -162,8 +319,10 @@ uint compile_slow_capture(PIO pio, uint pin_count, uint trigger_pin, uint trigge
     return prog_offset;
 }
 
-uint compile_fast_capture(PIO pio, uint pin_count, uint trigger_pin, uint trigger_type)
+uint compile_fast_capture(LOGIC_ANALYSER_T *analyser, uint trigger_pin, uint trigger_type)
 {
+    uint16_t *program_instructions = analyser->program_instructions;
+    uint pin_count = analyser->pin_count;
     uint8_t prog_offset = 0;
     if(trigger_type == 1 || trigger_type == 2)
     {
@@ -181,18 +340,19 @@ uint compile_fast_capture(PIO pio, uint pin_count, uint trigger_pin, uint trigge
     return prog_offset;
 }
 
-uint load_program(PIO pio, uint prog_offset, struct pio_program *pio_program, struct pio_program **current_program)
+uint load_program(LOGIC_ANALYSER_T *analyser, uint prog_offset)
 {
-    pio_program->instructions = program_instructions;
+    struct pio_program *pio_program = &analyser->pio_program;
+    pio_program->instructions = analyser->program_instructions;
     pio_program->length = prog_offset;
     pio_program->origin = -1;
     
-    *current_program = pio_program;
+    analyser->current_program = pio_program;
 
-    return pio_add_program(pio, *current_program);
+    return pio_add_program(analyser->pio, analyser->current_program);
 }
 
-uint compile_capture(PIO pio, pio_sm_config *c, uint pin_count, uint trigger_pin, uint trigger_type, float div)
+uint compile_capture(LOGIC_ANALYSER_T *analyser, pio_sm_config *c, uint trigger_pin, uint trigger_type, float div)
 {
     uint prog_offset;
     uint wrap_target;
@@ -213,7 +373,7 @@ uint compile_capture(PIO pio, pio_sm_config *c, uint pin_count, uint trigger_pin
             wrap_target = 2;
             wrap = 2;
         }
-        prog_offset = compile_fast_capture(pio, pin_count, trigger_pin, trigger_type);
+        prog_offset = compile_fast_capture(analyser, trigger_pin, trigger_type);
     }
     else
     {
@@ -231,9 +391,9 @@ uint compile_capture(PIO pio, pio_sm_config *c, uint pin_count, uint trigger_pin
             wrap_target = 2;
             wrap = 9;
         }
-        prog_offset = compile_slow_capture(pio, pin_count, trigger_pin, trigger_type);
+        prog_offset = compile_slow_capture(analyser, trigger_pin, trigger_type);
     }
-    load_offset = load_program(pio, prog_offset, &pio_program, &current_program);
+    load_offset = load_program(analyser, prog_offset);
     sm_config_set_wrap(c, load_offset + wrap_target, load_offset + wrap);
     sm_config_set_clkdiv(c, div);
  
@@ -23,21 +23,28 @@ typedef struct {
     uint32_t random_buf[32];
     bool dma_conf;
     bool random_run;
+    bool user_run;
     uint dma_chan;
     uint pin_base;
     uint pin_count;
     dma_channel_config dma_c;
 } Generator;
 
+static Generator generator_instance;
 Generator* generator=NULL;
 
+// uploaded pattern for pattern 4, owned by the caller
+static uint32_t const *user_pattern;
+static size_t user_pattern_words;
+
 void generator_initialise(PIO pio, uint sm, uint pin_base, uint dma_channel)
 {
-    generator = (Generator*)malloc(sizeof(Generator));
+    generator = &generator_instance;
     generator->generator_offset = 0;
     generator->generator_current_program = NULL;
     generator->dma_conf = false;
     generator->random_run = false;
+    generator->user_run = false;
     generator->pio = pio;
     generator->state_machine = sm;
     generator->pin_base = pin_base;
@@ -67,12 +74,39 @@ void generate_random()
     );
 }
 
+/*******************************************************************************************
+ * Replay the uploaded pattern from the start
+ * *****************************************************************************************/
+void generate_user_pattern()
+{
+    generator->dma_conf = true;
+
+    dma_channel_configure(generator->dma_chan, &generator->dma_c,
+        &generator->pio->txf[generator->state_machine],   // Destinatinon pointer
+        user_pattern,           // Source pointer
+        user_pattern_words,     // Number of transfers
+        true                    // Start immediately
+    );
+}
+
 void random_handler()
 {
     dma_hw->ints1 = 1u << generator->dma_chan;
     
     if(generator->random_run)
         generate_random();
+    else if(generator->user_run)
+        generate_user_pattern();
+}
+
+/*******************************************************************************************
+ * Set the pattern played by pattern 4, 4 samples per word with the first in the low byte.
+ * It is played in a loop. The buffer must stay valid while the pattern is running.
+ * *****************************************************************************************/
+void generator_set_user_pattern(uint32_t const *pattern, size_t words)
+{
+    user_pattern = pattern;
+    user_pattern_words = words;
 }
 
 void generate_pattern(PIO pio, uint sm, uint pattern, uint pin_base, uint dma_channel, float div)
@@ -89,6 +123,7 @@ void generate_pattern(PIO pio, uint sm, uint pattern, uint pin_base, uint dma_ch
         if(generator->dma_conf)
         {
             generator->random_run = false;
+            generator->user_run = false;
             dma_channel_abort(generator->dma_chan);
         }
     }
@@ -150,6 +185,33 @@ void generate_pattern(PIO pio, uint sm, uint pattern, uint pin_base, uint dma_ch
         generator->random_run = true;
         generate_random();
     }
+    else if(pattern == 4 && user_pattern_words)
+    {
+        generator->generator_current_program = &pattern_program;
+        generator->generator_offset = pio_add_program(pio, &pattern_program);
+        pio_sm_config c = pattern_program_get_default_config(generator->generator_offset);
+        sm_config_set_out_pins(&c, generator->pin_base, generator->pin_count);
+        sm_config_set_out_shift(&c, true, true, 32);
+        sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX);
+
+        for(int i=generator->pin_base;i<generator->pin_base+generator->pin_count; i++)
+            pio_gpio_init(pio, i);
+
+        pio_sm_set_consecutive_pindirs(pio, sm, generator->pin_base, generator->pin_count, true);
+
+        sm_config_set_clkdiv(&c, div);
+        pio_sm_init(pio, sm, generator->generator_offset, &c);
+        pio_sm_set_enabled(pio, sm, true);
+
+        if(!generator->dma_conf)
+        {
+            dma_channel_set_irq1_enabled(generator->dma_chan, true);
+            irq_set_exclusive_handler(DMA_IRQ_1, random_handler);
+            irq_set_enabled(DMA_IRQ_1, true);
+        }
+        generator->user_run = true;
+        generate_user_pattern();
+    }
     else
     {}
 }
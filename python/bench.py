@@ -0,0 +1,131 @@
+"""Measure query latency and how fast a capture can be read back.
+
+Times runs of "*IDN?" and "*OPC?" round trips and a pattern upload, then captures
+n samples once and times repeated "data?" reads of the whole capture. Over USBTMC the first
+Pico found with the 0xcafe vendor id is used, give --host to go over
+VXI-11 instead.
+
+With --netbench the network link itself is measured over VXI-11 with syst:netbench,
+the Pico sending synthetic blocks and then timing an upload, and the rate and
+retransmits it saw are printed next to the ones measured here.
+
+    python bench.py --samples 200000
+    python bench.py --host 192.168.1.46 --samples 200000
+    python bench.py --host 192.168.1.46 --netbench 200000
+"""
+import argparse
+import statistics
+import time
+
+HEADER_LEN = 8  # "#6nnnnnn"
+
+
+def open_usbtmc(vid, pid):
+    import usbtmc
+    if pid is not None:
+        return usbtmc.Instrument(vid, pid)
+    for dev in usbtmc.list_devices():
+        if dev.idVendor == vid:
+            return usbtmc.Instrument(dev)
+    raise SystemExit(f"no USBTMC device with vendor id 0x{vid:04x}")
+
+
+def open_vxi11(host):
+    import vxi11
+    return vxi11.Instrument(host)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", help="VXI-11 address, USBTMC is used if not given")
+    parser.add_argument("--vid", type=lambda v: int(v, 0), default=0xcafe)
+    parser.add_argument("--pid", type=lambda v: int(v, 0))
+    parser.add_argument("--samples", type=int, default=200000)
+    parser.add_argument("--rate", type=int, default=1000000)
+    parser.add_argument("--repeat", type=int, default=5)
+    parser.add_argument("--queries", type=int, default=100, help="round trips of each query to time")
+    parser.add_argument("--upload", type=int, default=16384, help="bytes of pattern to upload")
+    parser.add_argument("--netbench", type=int, default=0, help="bytes per syst:netbench run, needs --host")
+    args = parser.parse_args()
+
+    instr = open_vxi11(args.host) if args.host else open_usbtmc(args.vid, args.pid)
+    print(instr.ask("*IDN?").strip())
+
+    if args.netbench:
+        if not args.host:
+            raise SystemExit("--netbench needs --host")
+        netbench(instr, args.netbench, args.repeat)
+        return
+
+    for query in ("*IDN?", "*OPC?"):
+        times = []
+        for _ in range(args.queries):
+            start = time.perf_counter()
+            instr.ask(query)
+            times.append(time.perf_counter() - start)
+        print(f"{query} {args.queries} round trips, median {statistics.median(times) * 1000:.2f} ms, "
+              f"max {max(times) * 1000:.2f} ms ({len(times) / sum(times):.0f} queries/s)")
+
+    pattern = bytes(i & 0xff for i in range(args.upload))
+    length = str(len(pattern))
+    start = time.perf_counter()
+    instr.write_raw(f"l:patdata #{len(length)}{length}".encode() + pattern)
+    instr.ask("*opc?")
+    elapsed = time.perf_counter() - start
+    print(f"{args.upload} byte pattern uploaded in {elapsed * 1000:.1f} ms "
+          f"({args.upload / elapsed / 1024:.0f} KiB/s)")
+
+    instr.write(f"rate {args.rate}")
+    instr.write("trig 0 0")
+    instr.write(f"l:capture {args.samples}")
+    while instr.ask("*opc?").strip() != "1":
+        time.sleep(0.05)
+
+    times = []
+    for _ in range(args.repeat):
+        start = time.perf_counter()
+        instr.write("data?")
+        data = instr.read_raw()
+        times.append(time.perf_counter() - start)
+        if len(data) != args.samples + HEADER_LEN:
+            raise SystemExit(f"short read: {len(data) - HEADER_LEN} of {args.samples} samples")
+
+    best = min(times)
+    print(f"{args.samples} samples, best {best * 1000:.1f} ms ({args.samples / best / 1024:.0f} KiB/s), "
+          f"mean {sum(times) / len(times) * 1000:.1f} ms over {args.repeat} reads")
+
+
+def device_result(instr):
+    size, us, mbps, rexmit = instr.ask("syst:netbench:res?").strip().split(",")
+    return f"device {int(size)} bytes in {int(us) / 1000:.1f} ms, {float(mbps):.3f} MB/s, {rexmit} retransmits"
+
+
+def netbench(instr, size, repeat):
+    """Source then sink runs of syst:netbench, timed at both ends."""
+    for _ in range(repeat):
+        start = time.perf_counter()
+        instr.write(f"syst:netbench? {size}")
+        data = instr.read_raw()
+        elapsed = time.perf_counter() - start
+        received = len(data) - HEADER_LEN
+        print(f"source: host {received} bytes in {elapsed * 1000:.1f} ms, "
+              f"{received / elapsed / 1e6:.3f} MB/s; {device_result(instr)}")
+
+    # the sink drops the next size bytes, they must not run over into the *opc?
+    chunk = bytes(i & 0xff for i in range(16384))
+    for _ in range(repeat):
+        instr.write(f"syst:netbench:sink {size}")
+        sent = 0
+        start = time.perf_counter()
+        while sent < size:
+            n = min(len(chunk), size - sent)
+            instr.write_raw(chunk[:n])
+            sent += n
+        instr.ask("*opc?")
+        elapsed = time.perf_counter() - start
+        print(f"sink: host {sent} bytes in {elapsed * 1000:.1f} ms, "
+              f"{sent / elapsed / 1e6:.3f} MB/s; {device_result(instr)}")
+
+
+if __name__ == "__main__":
+    main()
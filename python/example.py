@@ -6,6 +6,7 @@ class PicoLogic:
     GENERATOR_SQUARE_WAVE=1
     GENERATOR_COUNT=2
     GENERATOR_RANDOM=3
+    GENERATOR_UPLOADED=4
     TRIGGER_OFF=0
     TRIGGER_LOW_LEVEL=1
     TRIGGER_HIGH_LEVEL=2
@@ -22,6 +23,11 @@ class PicoLogic:
     def set_pattern(self, pattern):
         self.vxi11.write(f"l:pat {pattern}")
 
+    def upload_pattern(self, samples):
+        # played in a loop by GENERATOR_UPLOADED, one byte per sample
+        length = str(len(samples))
+        self.vxi11.write_raw(f"l:patdata #{len(length)}{length}".encode() + bytes(samples))
+
     def set_rate(self, rate):
         self.vxi11.write(f"rate {rate}")
 
@@ -39,6 +45,16 @@ class PicoLogic:
         self.vxi11.write("data?")
         return self.vxi11.read_raw()[8:]
 
+    def get_range(self, start, length):
+        self.vxi11.write(f"data? {start},{length}")
+        return self.vxi11.read_raw()[8:]
+
+    def get_envelope(self, bucket, start=0, length=0):
+        self.vxi11.write(f"l:env? {bucket},{start},{length}")
+        env = self.vxi11.read_raw()[8:]
+        # (or, and) per bucket, channels that toggled are or ^ and
+        return [(env[i], env[i+1]) for i in range(0, len(env), 2)]
+
 instr = vxi11.Instrument("192.168.1.46")
 pico = PicoLogic(instr)
 
@@ -0,0 +1,300 @@
+"""Check the HiSLIP server against pyvisa-py's HiSLIP client.
+
+Opens a session, runs queries, pipelines writes, takes and releases the
+lock, does a device clear during a capture and waits for the service
+request raised when a capture completes. Each step prints ok or raises.
+
+With --raw the same steps run over a minimal client written from the
+HiSLIP 2.0 specification (IVI-6.1) instead, for hosts without VISA. It
+also checks the fields pyvisa does not look at: the negotiated mode, the
+message ids and the error codes of bad messages.
+
+    python hislip_check.py 192.168.1.46
+    python hislip_check.py --raw 192.168.1.46
+"""
+import argparse
+import socket
+import struct
+import time
+
+HEADER = struct.Struct(">2sBBIQ")
+INITIALIZE, INITIALIZE_RESPONSE, FATAL_ERROR, ERROR = 0, 1, 2, 3
+ASYNC_LOCK, ASYNC_LOCK_RESPONSE, DATA, DATA_END = 4, 5, 6, 7
+DEVICE_CLEAR_COMPLETE, DEVICE_CLEAR_ACKNOWLEDGE = 8, 9
+ASYNC_MAX_MSG_SIZE, ASYNC_MAX_MSG_SIZE_RESPONSE = 15, 16
+ASYNC_INITIALIZE, ASYNC_INITIALIZE_RESPONSE = 17, 18
+ASYNC_DEVICE_CLEAR, ASYNC_SERVICE_REQUEST = 19, 20
+ASYNC_STATUS_QUERY, ASYNC_STATUS_RESPONSE, ASYNC_DEVICE_CLEAR_ACK = 21, 22, 23
+FIRST_MESSAGE_ID = 0xFFFFFF00
+
+
+class HislipError(Exception):
+    pass
+
+
+class RawHislip:
+    """Just enough of a HiSLIP client to drive the checks, one message at a time."""
+
+    def __init__(self, host, port=4880, sub_address=b"hislip0", timeout=5.0):
+        self.sync = socket.create_connection((host, port), timeout=timeout)
+        self.sync.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self._send(self.sync, INITIALIZE, 0, (0x0100 << 16) | 0x5059, sub_address)
+        kind, control, parameter, _ = self._expect(self.sync, INITIALIZE_RESPONSE)
+        self.mode = control
+        self.session_id = parameter & 0xFFFF
+        self.server_version = parameter >> 16
+
+        self.asyn = socket.create_connection((host, port), timeout=timeout)
+        self.asyn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self._send(self.asyn, ASYNC_INITIALIZE, 0, self.session_id)
+        self._expect(self.asyn, ASYNC_INITIALIZE_RESPONSE)
+        self._send(self.asyn, ASYNC_MAX_MSG_SIZE, 0, 0, struct.pack(">Q", 1 << 20))
+        _, _, _, payload = self._expect(self.asyn, ASYNC_MAX_MSG_SIZE_RESPONSE)
+        self.max_message_size = struct.unpack(">Q", payload)[0]
+        self.message_id = FIRST_MESSAGE_ID
+        self.pending_srq = []
+
+    @staticmethod
+    def _send(sock, kind, control, parameter, payload=b""):
+        sock.sendall(HEADER.pack(b"HS", kind, control, parameter, len(payload)) + payload)
+
+    @staticmethod
+    def _recv_exact(sock, n):
+        data = bytearray()
+        while len(data) < n:
+            chunk = sock.recv(n - len(data))
+            if not chunk:
+                raise HislipError("connection closed")
+            data += chunk
+        return bytes(data)
+
+    def _receive(self, sock):
+        prologue, kind, control, parameter, length = HEADER.unpack(self._recv_exact(sock, HEADER.size))
+        if prologue != b"HS":
+            raise HislipError(f"bad prologue {prologue!r}")
+        return kind, control, parameter, self._recv_exact(sock, length)
+
+    def _expect(self, sock, kind):
+        while True:
+            message = self._receive(sock)
+            if message[0] == ASYNC_SERVICE_REQUEST:
+                self.pending_srq.append(message[1])
+                continue
+            if message[0] in (ERROR, FATAL_ERROR):
+                raise HislipError(f"{'fatal ' if message[0] == FATAL_ERROR else ''}error {message[1]}: {message[3]!r}")
+            if message[0] != kind:
+                raise HislipError(f"expected message type {kind}, got {message[0]}")
+            return message
+
+    def write(self, command):
+        self._send(self.sync, DATA_END, 0, self.message_id, command.encode() + b"\n")
+        self.last_id = self.message_id
+        self.message_id = (self.message_id + 2) & 0xFFFFFFFF
+
+    def read_raw(self):
+        data = b""
+        while True:
+            kind, _, parameter, payload = self._receive(self.sync)
+            if kind in (ERROR, FATAL_ERROR):
+                raise HislipError(f"error {_}: {payload!r}")
+            if kind not in (DATA, DATA_END):
+                raise HislipError(f"expected data, got message type {kind}")
+            if parameter != self.last_id:
+                raise HislipError(f"response id 0x{parameter:08x} for request 0x{self.last_id:08x}")
+            data += payload
+            if kind == DATA_END:
+                return data
+
+    def query(self, command):
+        self.write(command)
+        return self.read_raw().decode()
+
+    def query_block(self, command):
+        self.write(command)
+        data = self.read_raw()
+        digits = int(data[1:2])
+        length = int(data[2:2 + digits])
+        return data[2 + digits:2 + digits + length]
+
+    def lock_excl(self, timeout=0):
+        self._send(self.asyn, ASYNC_LOCK, 1, timeout)
+        _, control, _, _ = self._expect(self.asyn, ASYNC_LOCK_RESPONSE)
+        if control != 1:
+            raise HislipError(f"lock refused, response {control}")
+
+    def unlock(self):
+        self._send(self.asyn, ASYNC_LOCK, 0, self.message_id)
+        _, control, _, _ = self._expect(self.asyn, ASYNC_LOCK_RESPONSE)
+        if control != 1:
+            raise HislipError(f"release failed, response {control}")
+
+    def clear(self):
+        self._send(self.asyn, ASYNC_DEVICE_CLEAR, 0, 0)
+        _, features, _, _ = self._expect(self.asyn, ASYNC_DEVICE_CLEAR_ACK)
+        # a response already on its way is dropped, as the specification allows
+        self.sync.settimeout(0.5)
+        try:
+            while True:
+                kind = self._receive(self.sync)[0]
+                if kind not in (DATA, DATA_END):
+                    raise HislipError(f"unexpected message type {kind} before the clear")
+        except socket.timeout:
+            pass
+        finally:
+            self.sync.settimeout(5.0)
+        self._send(self.sync, DEVICE_CLEAR_COMPLETE, features, 0)
+        _, control, _, _ = self._expect(self.sync, DEVICE_CLEAR_ACKNOWLEDGE)
+        self.message_id = FIRST_MESSAGE_ID
+        return features, control
+
+    def status(self):
+        self._send(self.asyn, ASYNC_STATUS_QUERY, 0, self.message_id)
+        return self._expect(self.asyn, ASYNC_STATUS_RESPONSE)[1]
+
+    def wait_srq(self, timeout):
+        self.asyn.settimeout(timeout)
+        try:
+            while not self.pending_srq:
+                kind, control, _, _ = self._receive(self.asyn)
+                if kind == ASYNC_SERVICE_REQUEST:
+                    self.pending_srq.append(control)
+        finally:
+            self.asyn.settimeout(5.0)
+        return self.pending_srq.pop(0)
+
+    def send_bad_type(self):
+        """An unknown message type must be answered with Error, code 1, and not close."""
+        self._send(self.sync, 99, 0, 0)
+        kind, code, _, _ = self._receive(self.sync)
+        return kind, code
+
+    def close(self):
+        self.asyn.close()
+        self.sync.close()
+
+
+def check_raw(args):
+    instr = RawHislip(args.host, args.port)
+    assert instr.mode == 1, f"server offers mode {instr.mode}, expected overlapped"
+    print(f"initialize: ok, session {instr.session_id}, version 0x{instr.server_version:04x}, "
+          f"overlapped mode, max message {instr.max_message_size}")
+    print("idn:", instr.query("*IDN?").strip())
+
+    for rate in (1000, 10000, 100000):
+        instr.write(f"rate {rate}")
+    instr.write("trig 0 0")
+    assert instr.query("*opc?").strip() in ("0", "1")
+    print("pipelined writes: ok")
+
+    instr.lock_excl(1000)
+    other = RawHislip(args.host, args.port)
+    try:
+        other.lock_excl(0)
+        raise SystemExit("second session took the lock")
+    except HislipError:
+        pass
+    instr.unlock()
+    other.lock_excl(1000)
+    other.unlock()
+    other.close()
+    print("locking: ok")
+
+    instr.write("trig 0 1")
+    instr.write(f"l:acq? {args.samples}")
+    time.sleep(0.2)
+    features, acknowledged = instr.clear()
+    assert features == 1 and acknowledged == 1, f"clear negotiated {features}/{acknowledged}"
+    print("device clear: ok,", instr.query("*IDN?").strip())
+
+    kind, code = instr.send_bad_type()
+    assert kind == ERROR and code == 1, f"unknown message answered with type {kind} code {code}"
+    print("unknown message: ok, Error code 1,", instr.query("*IDN?").strip())
+
+    instr.write("trig 0 0")
+    instr.write("*sre 32")
+    instr.write(f"l:capture {args.samples}")
+    stb = instr.wait_srq(5.0)
+    print(f"service request: ok, status 0x{stb:02x}")
+
+    data = instr.query_block("data?")
+    assert len(data) == args.samples, f"{len(data)} of {args.samples} samples"
+    print(f"data: ok, {len(data)} samples")
+    instr.close()
+
+
+def check_visa(args):
+    import pyvisa
+
+    rm = pyvisa.ResourceManager("@py")
+    instr = rm.open_resource(f"TCPIP::{args.host}::hislip0::INSTR")
+    instr.timeout = 5000
+
+    print("idn:", instr.query("*IDN?").strip())
+
+    # pipelined writes, the query answers after all of them have run
+    for rate in (1000, 10000, 100000):
+        instr.write(f"rate {rate}")
+    instr.write("trig 0 0")
+    assert instr.query("*opc?").strip() in ("0", "1")
+    print("pipelined writes: ok")
+
+    instr.lock_excl(timeout=1000)
+    other = rm.open_resource(f"TCPIP::{args.host}::hislip0::INSTR")
+    try:
+        other.lock_excl(timeout=0)
+        raise SystemExit("second session took the lock")
+    except pyvisa.VisaIOError:
+        pass
+    instr.unlock()
+    other.lock_excl(timeout=1000)
+    other.unlock()
+    other.close()
+    print("locking: ok")
+
+    # a capture that never triggers is stopped by the device clear
+    instr.write("trig 0 1")
+    instr.write(f"l:acq? {args.samples}")
+    time.sleep(0.2)
+    instr.clear()
+    print("device clear: ok,", instr.query("*IDN?").strip())
+
+    instr.write("trig 0 0")
+    instr.write("*sre 32")
+    srq = pyvisa.constants.EventType.service_request
+    queue = pyvisa.constants.EventMechanism.queue
+    try:
+        instr.enable_event(srq, queue)
+    except (NotImplementedError, pyvisa.VisaIOError):
+        # not every backend handles events, poll for the end of the capture instead
+        instr.write(f"l:capture {args.samples}")
+        while instr.query("*opc?").strip() != "1":
+            time.sleep(0.05)
+        print("service request: skipped, the VISA backend has no event support")
+    else:
+        instr.write(f"l:capture {args.samples}")
+        instr.wait_on_event(srq, 5000)
+        instr.disable_event(srq, queue)
+        print("service request: ok")
+
+    data = instr.query_binary_values("data?", datatype="B", container=bytes)
+    assert len(data) == args.samples, f"{len(data)} of {args.samples} samples"
+    print(f"data: ok, {len(data)} samples")
+
+    instr.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("host")
+    parser.add_argument("--samples", type=int, default=20000)
+    parser.add_argument("--raw", action="store_true", help="use the built in client instead of pyvisa")
+    parser.add_argument("--port", type=int, default=4880, help="HiSLIP port, for --raw")
+    args = parser.parse_args()
+    if args.raw:
+        check_raw(args)
+    else:
+        check_visa(args)
+
+
+if __name__ == "__main__":
+    main()
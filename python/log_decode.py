@@ -0,0 +1,110 @@
+"""Decode the binary log frames written by a LOG_BINARY firmware build.
+
+The format strings are read from apps/log_formats.h, so use the same
+revision of the source as the firmware. Anything between frames (boot
+messages written with printf) is passed through as text.
+
+    python log_decode.py /dev/ttyUSB0
+    python log_decode.py --file capture.bin
+"""
+import argparse
+import os
+import re
+import struct
+import sys
+
+SYNC = b"\xa5\x5a"
+HEADER = struct.Struct("<HBBI")
+LEVELS = {1: "E", 2: "W", 3: "I", 4: "D"}
+DEFAULT_FORMATS = os.path.join(os.path.dirname(__file__), "..", "apps", "log_formats.h")
+
+
+def load_formats(path):
+    formats = []
+    with open(path) as f:
+        for line in f:
+            m = re.match(r'\s*LOG_FORMAT\(\s*(\w+)\s*,\s*"(.*)"\s*\)', line)
+            if m:
+                fmt = bytes(m.group(2), "utf-8").decode("unicode_escape")
+                # python has no length modifiers
+                fmt = re.sub(r"%([-+ #0]*\d*)[lhz]+([diuxX])", r"%\1\2", fmt)
+                formats.append(fmt)
+    return formats
+
+
+def to_signed(fmt, args):
+    # arguments arrive as uint32, %d and %i need them signed
+    conversions = re.findall(r"%[-+ #0]*\d*([diuxXc%])", fmt)
+    out = []
+    for conv, value in zip([c for c in conversions if c != "%"], args):
+        if conv in "di" and value & 0x80000000:
+            value -= 1 << 32
+        out.append(value)
+    return tuple(out)
+
+
+def decode(stream, formats, out):
+    buffer = b""
+    while True:
+        data = stream.read(256)
+        if not data:
+            break
+        buffer += data
+        while True:
+            start = buffer.find(SYNC)
+            if start < 0:
+                # keep a trailing 0xa5 in case it starts the next frame
+                keep = 1 if buffer.endswith(SYNC[:1]) else 0
+                out.write(buffer[:len(buffer) - keep].decode("ascii", "replace"))
+                buffer = buffer[len(buffer) - keep:]
+                break
+            if start:
+                out.write(buffer[:start].decode("ascii", "replace"))
+                buffer = buffer[start:]
+            if len(buffer) < 2 + HEADER.size:
+                break
+            format_id, level, nargs, timestamp = HEADER.unpack_from(buffer, 2)
+            length = 2 + HEADER.size + 4 * nargs
+            if len(buffer) < length:
+                break
+            args = struct.unpack_from(f"<{nargs}I", buffer, 2 + HEADER.size)
+            buffer = buffer[length:]
+            if format_id >= len(formats):
+                out.write(f"[{timestamp}] ?? unknown format {format_id} {args}\n")
+                continue
+            fmt = formats[format_id]
+            count = len([c for c in re.findall(r"%[-+ #0]*\d*([diuxXc%])", fmt) if c != "%"])
+            text = fmt % to_signed(fmt, args[:count])
+            out.write(f"[{timestamp}] {LEVELS.get(level, '?')} {text}")
+        out.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", nargs="?", help="serial port connected to the Pico UART")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--file", help="decode a saved binary log instead of a serial port")
+    parser.add_argument("--formats", default=DEFAULT_FORMATS, help="path to log_formats.h")
+    args = parser.parse_args()
+
+    formats = load_formats(args.formats)
+    if args.file:
+        with open(args.file, "rb") as stream:
+            decode(stream, formats, sys.stdout)
+    elif args.port:
+        import serial
+        with serial.Serial(args.port, args.baud, timeout=0.1) as port:
+            class Reader:
+                def read(self, n):
+                    # keep waiting on an idle line rather than ending the decode
+                    while True:
+                        data = port.read(n)
+                        if data:
+                            return data
+            decode(Reader(), formats, sys.stdout)
+    else:
+        parser.error("give a serial port or --file")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,62 @@
+"""Read the continuous sample stream from the vendor USB interface.
+
+Streaming is started over USBTMC, then the raw samples (one byte per
+sample, D0 in bit 0) are read from the vendor Bulk-IN endpoint until
+--seconds have passed. The throughput and the overruns reported by the
+Pico are printed at the end.
+
+    python stream.py --rate 500000 --seconds 10 --out samples.bin
+"""
+import argparse
+import time
+
+import usb.core
+import usb.util
+import usbtmc
+
+VENDOR_INTERFACE = 1
+VENDOR_EP_IN = 0x83
+READ_SIZE = 16384
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--vid", type=lambda v: int(v, 0), default=0xcafe)
+    parser.add_argument("--rate", type=int, default=500000)
+    parser.add_argument("--seconds", type=float, default=5)
+    parser.add_argument("--out", help="write the samples to this file")
+    args = parser.parse_args()
+
+    dev = usb.core.find(idVendor=args.vid)
+    if dev is None:
+        raise SystemExit(f"no device with vendor id 0x{args.vid:04x}")
+    instr = usbtmc.Instrument(dev)
+    instr.write(f"rate {args.rate}")
+    instr.write("trig 0 0")
+
+    usb.util.claim_interface(dev, VENDOR_INTERFACE)
+    out = open(args.out, "wb") if args.out else None
+    total = 0
+    instr.write("l:stream 1")
+    start = time.perf_counter()
+    try:
+        while time.perf_counter() - start < args.seconds:
+            data = dev.read(VENDOR_EP_IN, READ_SIZE, timeout=1000)
+            total += len(data)
+            if out:
+                out.write(data)
+    finally:
+        elapsed = time.perf_counter() - start
+        instr.write("l:stream 0")
+        status = instr.ask("l:stream?").strip()
+        if out:
+            out.close()
+        usb.util.release_interface(dev, VENDOR_INTERFACE)
+
+    running, blocks, overruns = status.split(",")
+    print(f"{total} samples in {elapsed:.1f} s ({total / elapsed / 1024:.0f} KiB/s), "
+          f"{blocks} blocks captured, {overruns} dropped")
+
+
+if __name__ == "__main__":
+    main()
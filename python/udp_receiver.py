@@ -0,0 +1,153 @@
+"""Receive the UDP sample stream of the vxitmc build and report what was lost.
+
+The Pico is told where to send with "l:stream:udp <port>" over VXI-11 and
+streaming is started with "l:stream 1". Every datagram carries 1024 samples
+of a 4096 sample block behind a 20 byte header:
+
+    magic "PLS1", sequence, block, offset (16 bit), flags (16 bit), overruns
+
+all big endian. A gap in sequence is datagrams lost on the network. Blocks the
+Pico dropped because it could not keep up are counted in overruns, so a gap in
+the samples is split between the two by how much overruns went up across it. Lost samples are written as zeros with --fill, so the output keeps
+its timing, otherwise they are left out. Either way every gap is listed.
+
+    python udp_receiver.py --host 192.168.1.46 --rate 500000 --seconds 10 --out samples.bin
+"""
+import argparse
+import socket
+import struct
+import time
+
+HEADER = struct.Struct(">IIIHHI")
+MAGIC = 0x504C5331
+PAYLOAD = 1024
+BLOCK_BYTES = 4096
+
+
+class Reassembler:
+    """Puts datagrams back in order within a small window and tracks the gaps."""
+
+    def __init__(self, out, fill, window=64):
+        self.out = out
+        self.fill = fill
+        self.window = window
+        self.pending = {}
+        self.next_sequence = None
+        self.next_position = None   # sample position, block * BLOCK_BYTES + offset
+        self.samples = 0
+        self.lost_datagrams = 0
+        self.dropped_blocks = 0
+        self.late = 0
+        self.overruns = 0
+        self.written_overruns = None    # overruns of the last datagram written
+        self.gaps = []
+
+    def add(self, datagram):
+        if len(datagram) < HEADER.size:
+            return
+        magic, sequence, block, offset, flags, overruns = HEADER.unpack_from(datagram)
+        if magic != MAGIC:
+            return
+        if self.next_sequence is None:
+            self.next_sequence = sequence
+            self.next_position = block * BLOCK_BYTES + offset
+        if sequence < self.next_sequence:
+            self.late += 1      # arrived after its gap was given up on
+            return
+        self.pending[sequence] = (block * BLOCK_BYTES + offset, overruns, datagram[HEADER.size:])
+        self.overruns = overruns
+        while self.pending:
+            if self.next_sequence in self.pending:
+                self._write(self.pending.pop(self.next_sequence))
+                self.next_sequence += 1
+            elif len(self.pending) > self.window or max(self.pending) - self.next_sequence > self.window:
+                # give up waiting for the missing datagram
+                self.lost_datagrams += 1
+                self.next_sequence += 1
+            else:
+                break
+
+    def flush(self):
+        while self.pending:
+            if self.next_sequence in self.pending:
+                self._write(self.pending.pop(self.next_sequence))
+            else:
+                self.lost_datagrams += 1
+            self.next_sequence += 1
+
+    def _write(self, entry):
+        position, overruns, samples = entry
+        if self.written_overruns is None:
+            self.written_overruns = overruns
+        if position != self.next_position:
+            missing = position - self.next_position
+            # the datagram flagged as the first after the drop may itself be lost, the
+            # overrun count in every header still says how many blocks were dropped
+            dropped = min((overruns - self.written_overruns) * BLOCK_BYTES, missing)
+            if dropped > 0:
+                self.gaps.append((self.next_position, dropped, "dropped by the Pico"))
+                self.dropped_blocks += dropped // BLOCK_BYTES
+            if missing > dropped:
+                self.gaps.append((self.next_position, missing - dropped, "lost on the network"))
+            if self.out and self.fill and missing > 0:
+                self.out.write(bytes(missing))
+        if self.out:
+            self.out.write(samples)
+        self.samples += len(samples)
+        self.next_position = position + len(samples)
+        self.written_overruns = overruns
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", help="Pico to start the stream on over VXI-11, else just listen")
+    parser.add_argument("--port", type=int, default=5030)
+    parser.add_argument("--rate", type=int, default=500000)
+    parser.add_argument("--seconds", type=float, default=5)
+    parser.add_argument("--out", help="write the samples to this file")
+    parser.add_argument("--fill", action="store_true", help="write zeros for lost samples")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 * 1024 * 1024)
+    sock.bind(("", args.port))
+    sock.settimeout(1.0)
+
+    instr = None
+    if args.host:
+        import vxi11
+        instr = vxi11.Instrument(args.host)
+        instr.write(f"rate {args.rate}")
+        instr.write("trig 0 0")
+        instr.write(f"l:stream:udp {args.port}")
+        instr.write("l:stream 1")
+
+    out = open(args.out, "wb") if args.out else None
+    rx = Reassembler(out, args.fill)
+    start = time.perf_counter()
+    try:
+        while time.perf_counter() - start < args.seconds:
+            try:
+                data, _ = sock.recvfrom(HEADER.size + PAYLOAD)
+            except socket.timeout:
+                continue
+            rx.add(data)
+    finally:
+        elapsed = time.perf_counter() - start
+        if instr:
+            instr.write("l:stream 0")
+            print("Pico stream address,port,datagrams,send errors:", instr.ask("l:stream:udp?").strip())
+        rx.flush()
+        if out:
+            out.close()
+
+    print(f"{rx.samples} samples in {elapsed:.1f} s ({rx.samples / elapsed / 1024:.0f} KiB/s)")
+    print(f"{rx.lost_datagrams} datagrams lost on the network, {rx.dropped_blocks} blocks dropped by the Pico, "
+          f"{rx.late} arrived too late, {rx.overruns} overruns reported by the Pico")
+    for position, missing, cause in rx.gaps[:20]:
+        print(f"  gap of {missing} samples at {position}, {cause}")
+    if len(rx.gaps) > 20:
+        print(f"  ... {len(rx.gaps) - 20} more")
+
+
+if __name__ == "__main__":
+    main()